@@ -3,8 +3,10 @@ import java.lang.reflect.*;
 import java.io.*;
 import java.net.*;
 import java.util.*;
+import java.util.concurrent.*;
 import java.util.jar.*;
 import java.util.regex.*;
+import java.util.zip.*;
 
 public class APIGenerator
 {
@@ -16,22 +18,82 @@ public class APIGenerator
 		public int compare(Class lhs, Class rhs) { return lhs.getName().compareTo(rhs.getName()); }
 	};
 
-	final Set<Class> m_AllClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+	// Every (valid) class name in the jars, sorted like Class.getName() and keyed by c++ name
+	final SortedSet<String> m_AllClassNames = new TreeSet<String>();
+	final Map<String, String> m_ClassNamesByCppName = new HashMap<String, String>();
 	final Set<Class> m_VisitedClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
 	final Set<Class> m_DependencyChain = new LinkedHashSet<Class>();
 
+	static final String USAGE = "Usage: APIGenerator [--natives=<regex>] [--used=<file>] [--hot=<file>] [--profile=<file>] [--hot-limit=<n>] [--memoize=<file>] [--mirror=<regex>] [--index-cache=<dir>] [--opaque] <dst> <jarfile[;jarfile;...]> <regex...>\n";
+
+	// Used by the bridge itself (boxing, proxies) or by templates; never pruned
+	final static Set<String> FULL_CLASSES = new HashSet<String>(Arrays.asList(new String[] {
+		"java.lang.Object", "java.lang.String", "java.lang.CharSequence", "java.lang.Number",
+		"java.lang.Byte", "java.lang.Short", "java.lang.Integer", "java.lang.Long",
+		"java.lang.Float", "java.lang.Double", "java.lang.Character", "java.lang.Boolean",
+		"java.lang.Class", "java.lang.NoSuchMethodError", "java.lang.System", "java.lang.reflect.Method"
+	}));
+
+	final Set<Class> m_OpaqueClasses = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+
+	final Map<Class, Map<String, Object>> m_ConstantValues = new HashMap<Class, Map<String, Object>>();
+	final Map<Class, List<String>> m_EnumConstants = new HashMap<Class, List<String>>();
+	ClassLoader m_ClassLoader;
+
+	Pattern m_NativeClasses;
+	Pattern m_MirroredClasses;
+	Set<String> m_UsedSymbols;
+	Set<String> m_HotSymbols;
+	Map<String, Long> m_MemoizedSymbols;
+	final Map<Class, ByteArrayOutputStream> m_InlineDefinitions = new TreeMap<Class, ByteArrayOutputStream>(CLASSNAME_COMPARATOR);
+	boolean m_Opaque;
+	File m_IndexCache; // jar class indices; <dst> if not set
+
 	public static void main(String[] argsArray) throws Exception
 	{
 		LinkedList<String> args = new LinkedList<String>(Arrays.asList(argsArray));
+		APIGenerator generator = new APIGenerator();
+		File profile = null;
+		int hotLimit = 64;
+		while (!args.isEmpty() && args.peekFirst().startsWith("--"))
+		{
+			String option = args.pollFirst();
+			if (option.startsWith("--natives="))
+				generator.m_NativeClasses = Pattern.compile(option.substring("--natives=".length()));
+			else if (option.startsWith("--used="))
+				generator.m_UsedSymbols = readSymbols(new File(option.substring("--used=".length())));
+			else if (option.startsWith("--hot="))
+				generator.addHotSymbols(readSymbols(new File(option.substring("--hot=".length()))));
+			else if (option.startsWith("--profile="))
+				profile = new File(option.substring("--profile=".length()));
+			else if (option.startsWith("--hot-limit="))
+				hotLimit = Integer.parseInt(option.substring("--hot-limit=".length()));
+			else if (option.startsWith("--memoize="))
+				generator.m_MemoizedSymbols = readMemoized(new File(option.substring("--memoize=".length())));
+			else if (option.startsWith("--mirror="))
+				generator.m_MirroredClasses = Pattern.compile(option.substring("--mirror=".length()));
+			else if (option.startsWith("--index-cache="))
+				generator.m_IndexCache = new File(option.substring("--index-cache=".length()));
+			else if (option.equals("--opaque"))
+				generator.m_Opaque = true;
+			else
+			{
+				System.err.format(USAGE);
+				System.err.format("%s: unknown option.\n", option);
+				System.exit(1);
+			}
+		}
 		if (args.size() < 2)
 		{
-			System.err.format("Usage: APIGenerator <dst> <jarfile[;jarfile;...]> <regex...>\n");
+			System.err.format(USAGE);
 			System.exit(1);
 		}
+		if (profile != null)
+			generator.addHotSymbols(readProfile(profile, hotLimit));
 		String dst = args.pollFirst();
 		if (!new File(dst).isDirectory())
 		{
-			System.err.format("Usage: APIGenerator <dst> <jarfile[;jarfile;...]> <regex...>\n");
+			System.err.format(USAGE);
 			System.err.format("%s: is not a directory.\n", dst);
 			System.exit(1);
 		}
@@ -44,7 +106,7 @@ public class APIGenerator
 			{
 				if (!new File(jar).isFile())
 				{
-					System.err.format("Usage: APIGenerator <dst> <jarfile[;jarfile;...]> <regex...>\n");
+					System.err.format(USAGE);
 					System.err.format("%s: is not a jar file.\n", jar);
 					System.exit(1);
 				}
@@ -56,7 +118,7 @@ public class APIGenerator
 		}
 		else if (!new File(jarList).isFile())
 		{
-			System.err.format("Usage: APIGenerator <dst> <jarfile[;jarfile;...]> <regex...>\n");
+			System.err.format(USAGE);
 			System.err.format("%s: is not a jar file.\n", jarList);
 			System.exit(1);
 		}
@@ -66,6 +128,7 @@ public class APIGenerator
 		}
 
 		// We need this to box proxy values
+		args.add("::java::lang::Object");
 		args.add("::java::lang::Byte");
 		args.add("::java::lang::Short");
 		args.add("::java::lang::Integer");
@@ -78,47 +141,165 @@ public class APIGenerator
 		args.add("::java::lang::NoSuchMethodError");
 		args.add("::java::lang::System");
 
-		APIGenerator generator = new APIGenerator();
-		generator.collectDependencies(jars, args);
+		generator.collectDependencies(dst, jars, args);
 		generator.print(dst);
 	}
 
-	public void collectDependencies(LinkedList<JarFile> files, LinkedList<String> args) throws Exception
+	// One symbol per line, e.g. '::java::lang::String::Length' or demangled 'java::lang::String::Length(...) const'.
+	// A class name on its own keeps the whole class; constructors are named like the class ('::java::io::File::File').
+	private static Set<String> readSymbols(File file) throws IOException
 	{
-		LinkedList<URL> urls = new LinkedList<URL>();
-		for(JarFile file : files)
+		Set<String> symbols = new HashSet<String>();
+		BufferedReader reader = new BufferedReader(new FileReader(file));
+		try
 		{
-			urls.push(new File(file.getName()).toURI().toURL());
+			for (String line = reader.readLine(); line != null; line = reader.readLine())
+			{
+				int end = line.indexOf('(');
+				String symbol = (end < 0 ? line : line.substring(0, end)).trim();
+				if (symbol.isEmpty() || symbol.startsWith("#"))
+					continue;
+				symbols.add(symbol.startsWith("::") ? symbol : "::" + symbol);
+			}
 		}
-		URLClassLoader customClasses = new URLClassLoader(urls.toArray(new URL[urls.size()]), null);
+		finally
+		{
+			reader.close();
+		}
+		return symbols;
+	}
 
-		for(JarFile file : files)
+	// Call counts, one '<count> <symbol>' per line (symbols as in readSymbols); returns the 'limit' most called symbols.
+	private static Set<String> readProfile(File file, int limit) throws IOException
+	{
+		final Map<String, Long> counts = new HashMap<String, Long>();
+		BufferedReader reader = new BufferedReader(new FileReader(file));
+		try
+		{
+			for (String line = reader.readLine(); line != null; line = reader.readLine())
+			{
+				line = line.trim();
+				if (line.isEmpty() || line.startsWith("#"))
+					continue;
+				String[] fields = line.split("\\s+", 2);
+				if (fields.length < 2)
+					continue;
+				int end = fields[1].indexOf('(');
+				String symbol = (end < 0 ? fields[1] : fields[1].substring(0, end)).trim();
+				if (!symbol.startsWith("::"))
+					symbol = "::" + symbol;
+				Long count = counts.get(symbol);
+				counts.put(symbol, (count == null ? 0 : count) + Long.parseLong(fields[0]));
+			}
+		}
+		finally
 		{
-			System.err.format("Loading classes from '%s'\n", file.getName());
+			reader.close();
+		}
+
+		List<String> symbols = new ArrayList<String>(counts.keySet());
+		Collections.sort(symbols, new Comparator<String>() {
+			public int compare(String lhs, String rhs) { return counts.get(rhs).compareTo(counts.get(lhs)); }
+		});
+		return new HashSet<String>(symbols.subList(0, Math.min(limit, symbols.size())));
+	}
 
-			Enumeration<JarEntry> entries = file.entries();
-			while (entries.hasMoreElements())
+	// Members whose result doesn't change, one '<symbol> [ttl in ms]' per line (symbols as in readSymbols).
+	private static Map<String, Long> readMemoized(File file) throws IOException
+	{
+		Map<String, Long> symbols = new HashMap<String, Long>();
+		BufferedReader reader = new BufferedReader(new FileReader(file));
+		try
+		{
+			for (String line = reader.readLine(); line != null; line = reader.readLine())
 			{
-				String name = entries.nextElement().getName();
-				if (name.endsWith(".class"))
+				line = line.trim();
+				if (line.isEmpty() || line.startsWith("#"))
+					continue;
+				long ttl = 0;
+				Matcher matcher = Pattern.compile("(.*)\\s+(\\d+)").matcher(line);
+				if (matcher.matches())
 				{
-					try
-					{
-						m_AllClasses.add(customClasses.loadClass(name.substring(0, name.length() - 6).replace("/", ".")));
-					} catch (Throwable ignore) {}
+					line = matcher.group(1);
+					ttl = Long.parseLong(matcher.group(2));
 				}
+				int end = line.indexOf('(');
+				String symbol = (end < 0 ? line : line.substring(0, end)).trim();
+				symbols.put(symbol.startsWith("::") ? symbol : "::" + symbol, ttl);
+			}
+		}
+		finally
+		{
+			reader.close();
+		}
+		return symbols;
+	}
+
+	private void addHotSymbols(Set<String> symbols)
+	{
+		if (m_HotSymbols == null)
+			m_HotSymbols = new HashSet<String>();
+		m_HotSymbols.addAll(symbols);
+	}
+
+	public void collectDependencies(String dst, LinkedList<JarFile> files, LinkedList<String> args) throws Exception
+	{
+		LinkedList<URL> urls = new LinkedList<URL>();
+		for(JarFile file : files)
+		{
+			urls.push(new File(file.getName()).toURI().toURL());
+		}
+		URLClassLoader customClasses = new URLClassLoader(urls.toArray(new URL[urls.size()]), null);
+		m_ClassLoader = customClasses;
+
+		// Classes are only loaded once they match; the names come from a per jar index
+		ExecutorService executor = Executors.newFixedThreadPool(Math.max(1, Math.min(files.size(), Runtime.getRuntime().availableProcessors())));
+		LinkedList<Future<List<String>>> indices = new LinkedList<Future<List<String>>>();
+		final File dir = m_IndexCache != null ? m_IndexCache : new File(dst);
+		if (!dir.isDirectory() && !dir.mkdirs())
+			throw new IOException(dir + ": can't create index cache directory");
+		for (final JarFile file : files)
+		{
+			indices.add(executor.submit(new Callable<List<String>>() {
+				public List<String> call() throws Exception { return loadClassIndex(dir, file); }
+			}));
+		}
+		executor.shutdown();
+		for (Future<List<String>> index : indices)
+		{
+			for (String className : index.get())
+			{
+				if (!isValidClassName(className))
+					continue;
+				m_AllClassNames.add(className);
+				String cppClassName = getClassName(className);
+				if (!m_ClassNamesByCppName.containsKey(cppClassName) || className.compareTo(m_ClassNamesByCppName.get(cppClassName)) < 0)
+					m_ClassNamesByCppName.put(cppClassName, className);
 			}
 		}
 
 		System.err.format("Searching for candidates\n");
 		for (String arg : args)
 		{
+			// plain class names don't need a scan
+			Collection<String> candidates = m_AllClassNames;
+			if (arg.matches("[\\w:]+"))
+			{
+				String className = m_ClassNamesByCppName.get(arg);
+				candidates = className != null ? Collections.singletonList(className) : Collections.<String>emptyList();
+			}
+
 			Pattern pattern = Pattern.compile(arg);
-			for (Class clazz : m_AllClasses)
+			for (String className : candidates)
 			{
-				String cppClassName = getClassName(clazz);
+				String cppClassName = getClassName(className);
 				if (!pattern.matcher(cppClassName).matches())
 					continue;
+				Class clazz;
+				try
+				{
+					clazz = customClasses.loadClass(className);
+				} catch (Throwable ignore) { continue; }
 				int nClasses = m_DependencyChain.size();
 				collectDependencies(clazz);
 				System.err.format("[%d][%d]\t%s\n", m_DependencyChain.size(), m_DependencyChain.size() - nClasses, cppClassName);
@@ -127,13 +308,81 @@ public class APIGenerator
 		}
 	}
 
+	// Class names of a jar, cached in 'dir' (--index-cache or <dst>) by jar checksum
+	private static List<String> loadClassIndex(File dir, JarFile file) throws IOException
+	{
+		File index = new File(dir, String.format("classes-%08x.idx", getChecksum(new File(file.getName()))));
+		List<String> classNames = new ArrayList<String>();
+		if (index.isFile())
+		{
+			System.err.format("Loading class index of '%s'\n", file.getName());
+			BufferedReader reader = new BufferedReader(new FileReader(index));
+			try
+			{
+				for (String line = reader.readLine(); line != null; line = reader.readLine())
+					classNames.add(line);
+			}
+			finally
+			{
+				reader.close();
+			}
+			return classNames;
+		}
+
+		System.err.format("Indexing classes from '%s'\n", file.getName());
+		Enumeration<JarEntry> entries = file.entries();
+		while (entries.hasMoreElements())
+		{
+			String name = entries.nextElement().getName();
+			if (name.endsWith(".class"))
+				classNames.add(name.substring(0, name.length() - 6).replace("/", "."));
+		}
+
+		// write to a temporary file first; a partial index must never be picked up
+		File temp = new File(dir, index.getName() + ".tmp");
+		PrintStream out = new PrintStream(new FileOutputStream(temp));
+		for (String className : classNames)
+			out.println(className);
+		out.close();
+		temp.renameTo(index);
+		return classNames;
+	}
+
+	private static long getChecksum(File file) throws IOException
+	{
+		CheckedInputStream in = new CheckedInputStream(new FileInputStream(file), new Adler32());
+		try
+		{
+			byte[] buffer = new byte[64 * 1024];
+			while (in.read(buffer) >= 0) {}
+		}
+		finally
+		{
+			in.close();
+		}
+		return in.getChecksum().getValue();
+	}
+
+	// Same as isValid(Class) without loading the class: no anonymous/local classes and no package-info
+	private static boolean isValidClassName(String className)
+	{
+		String simpleName = className.substring(className.lastIndexOf('.') + 1);
+		if ("package-info".equals(simpleName))
+			return false;
+		for (String part : simpleName.split("\\$"))
+			if (part.isEmpty() || Character.isDigit(part.charAt(0)))
+				return false;
+		return true;
+	}
+
 	public void collectDependencies(Class clazz) throws Exception
 	{
 		clazz = collectDirectDependencies(clazz);
 		if (clazz == null)
 			return;
 
-		if (m_VisitedClasses.contains(clazz))
+		// opaque classes are upgraded once something needs them in full
+		if (m_VisitedClasses.contains(clazz) && !m_OpaqueClasses.remove(clazz))
 			return;
 
 		m_VisitedClasses.add(clazz);
@@ -147,26 +396,54 @@ public class APIGenerator
 
 		for (Field field : getDeclaredFieldsSorted(clazz))
 		{
-			if (!isValid(field))
+			if (!isValid(field) || !isUsed(field))
 				continue;
-			collectDependencies(field.getType());
+			collectReference(field.getType());
 		}
 
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
-			if (!isValid(method))
+			if (!isValid(method) || !(isUsed(method) || clazz.isInterface()))
 				continue;
 			for (Class paramType : method.getParameterTypes())
-				collectDependencies(paramType);
-			collectDependencies(method.getReturnType());
+				collectReference(paramType);
+			collectReference(method.getReturnType());
 		}
 
 		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
 		{
-			if (!isValid(constructor))
+			if (!isValid(constructor) || !isUsed(constructor))
 				continue;
 			for (Class paramType : constructor.getParameterTypes())
-				collectDependencies(paramType);
+				collectReference(paramType);
+		}
+
+		// natives of any visibility are implemented on the c++ side
+		for (Method method : getNativeMethodsSorted(clazz))
+		{
+			for (Class paramType : method.getParameterTypes())
+				collectReference(paramType);
+			collectReference(method.getReturnType());
+		}
+	}
+
+	// Types used in signatures; with --opaque these only become handles
+	private void collectReference(Class clazz) throws Exception
+	{
+		while (clazz.isArray())
+			clazz = clazz.getComponentType();
+
+		if (!m_Opaque || !isValid(clazz))
+			collectDependencies(clazz);
+		else if (m_VisitedClasses.contains(clazz))
+			return;
+		else if (FULL_CLASSES.contains(clazz.getName()) || new File("templates", clazz.getName() + ".h").exists())
+			collectDependencies(clazz);
+		else
+		{
+			m_DependencyChain.add(clazz);
+			m_VisitedClasses.add(clazz);
+			m_OpaqueClasses.add(clazz);
 		}
 	}
 
@@ -224,7 +501,11 @@ public class APIGenerator
 			return "Array< " + getClassName(clazz.getComponentType()) + " >";
 		if (clazz.isPrimitive())
 			return "j" + clazz.getSimpleName();
-		String fullClassName = clazz.getName();
+		return getSimpleName(clazz.getName());
+	}
+
+	private String getSimpleName(String fullClassName)
+	{
 		return safe(fullClassName.substring(fullClassName.lastIndexOf('.') + 1), null).replace('$', '_');
 	}
 
@@ -248,8 +529,12 @@ public class APIGenerator
 			return "";
 		if (clazz.isArray())
 			return "jni";
-		String fullName = clazz.getName();
-		String simpleName = getSimpleName(clazz);
+		return getNameSpace(clazz.getName());
+	}
+
+	private String getNameSpace(String fullName)
+	{
+		String simpleName = getSimpleName(fullName);
 		String packageName = fullName.substring(0, Math.max(fullName.length() - simpleName.length() - 1, 0));
 		StringBuilder namespace = new StringBuilder("");
 		String[] namespaceComponents = packageName.split("\\.");
@@ -341,8 +626,15 @@ public class APIGenerator
 		return buffer.toString();
 	}
 
+	private String getClassName(String fullClassName)
+	{
+		return getNameSpace(fullClassName) + "::" + getSimpleName(fullClassName);
+	}
+
 	private String getSuperClassName(Class clazz)
 	{
+		if (isOpaque(clazz))
+			return "::java::lang::Object";
 		Class superClass = clazz.getSuperclass();
 		if (superClass == null)
 			return clazz.isInterface() ? "java::lang::Object" : "jni::Object";
@@ -369,6 +661,67 @@ public class APIGenerator
 	private boolean isProtected(Member member)		{ return (Modifier.PROTECTED & member.getModifiers()) != 0; }
 	private boolean isValid(Member member)			{ return (isPublic(member) || isProtected(member)) && !member.isSynthetic(); }
 	private boolean isValid(Method method)			{ return isValid((Member) method) && !method.isBridge(); }
+	private boolean isFullClass(Class clazz)
+	{
+		return m_UsedSymbols == null
+			|| FULL_CLASSES.contains(clazz.getName())
+			|| m_UsedSymbols.contains(getClassName(clazz))
+			|| new File("templates", clazz.getName() + ".h").exists();
+	}
+
+	// Opaque classes are plain handles: no super types, members or proxies
+	private boolean isOpaque(Class clazz)
+	{
+		return m_OpaqueClasses.contains(clazz);
+	}
+
+	// Members nobody refers to are left out when pruning; their classes stay opaque wrappers
+	private boolean isUsed(Member member)
+	{
+		Class clazz = member.getDeclaringClass();
+		if (isOpaque(clazz))
+			return false;
+		if (isFullClass(clazz))
+			return true;
+		String name;
+		if (member instanceof Field)
+			name = getFieldName((Field) member);
+		else if (member instanceof Method)
+			name = getMethodName((Method) member);
+		else
+			name = getSimpleName(clazz);
+		return m_UsedSymbols.contains(getClassName(clazz) + "::" + name);
+	}
+
+	// Hot members are defined inline (<class>.inl.h) with pre-resolved id slots instead of going through the shared stubs
+	private boolean isHot(Member member)
+	{
+		if (m_HotSymbols == null)
+			return false;
+		Class clazz = member.getDeclaringClass();
+		if (m_HotSymbols.contains(getClassName(clazz)))
+			return true;
+		String name = member instanceof Field ? getFieldName((Field) member) : getMethodName((Method) member);
+		return m_HotSymbols.contains(getClassName(clazz) + "::" + name);
+	}
+
+	// Ttl in milliseconds (0: until invalidated) of a member listed in --memoize, null if it isn't memoized.
+	// Only getters qualify; fields and methods without parameters that return a value.
+	private Long getMemoTtl(Member member)
+	{
+		if (m_MemoizedSymbols == null)
+			return null;
+		String name;
+		if (member instanceof Field)
+			name = getFieldName((Field) member);
+		else if (member instanceof Method && ((Method) member).getParameterTypes().length == 0 && ((Method) member).getReturnType() != Void.TYPE)
+			name = getMethodName((Method) member);
+		else
+			return null;
+		return m_MemoizedSymbols.get(getClassName(member.getDeclaringClass()) + "::" + name);
+	}
+
+	private boolean isNative(Member member)			{ return (Modifier.NATIVE & member.getModifiers()) != 0; }
 	private boolean isValid(Constructor ctor, Class clazz)
 	{
 		return !(ctor.getParameterTypes().length == 1 && ctor.getParameterTypes()[0] == clazz)
@@ -448,6 +801,14 @@ public class APIGenerator
 		return buffer.toString();
 	}
 
+	private String getParameterFromJNIObjectArray(Class<?> parameterType, int i)
+	{
+		return String.format("%s(jni::GetObjectArrayElement(args, %d))%s",
+			getClassName(box(parameterType)),
+			i,
+			runtimeUnbox(parameterType));
+	}
+
 	private String getParametersFromJNIObjectArray(Class<?>[] parameterTypes)
 	{
 		StringBuilder buffer = new StringBuilder();
@@ -455,48 +816,232 @@ public class APIGenerator
 		{
 			if (i > 0)
 				buffer.append(", ");
-			buffer.append(getClassName(box(parameterTypes[i])));
-			buffer.append("(jni::GetObjectArrayElement(args, ");
-			buffer.append(i);
-			buffer.append("))");
-			buffer.append(runtimeUnbox(parameterTypes[i]));
+			buffer.append(getParameterFromJNIObjectArray(parameterTypes[i], i));
 		}
 		return buffer.toString();
 	}
 
+	private String getParameterLocalsFromJNIObjectArray(Class<?>[] parameterTypes)
+	{
+		StringBuilder buffer = new StringBuilder();
+		for (int i = 0; i < parameterTypes.length; ++i)
+			buffer.append(String.format("%s arg%d(%s); ",
+				getClassName(parameterTypes[i]),
+				i,
+				getParameterFromJNIObjectArray(parameterTypes[i], i)));
+		return buffer.toString();
+	}
+
 	private void print(String dst) throws Exception
 	{
 		System.err.println("Generating cpp code");
-		// Implement classes
+		// Implement classes; one translation unit per class so they can be built in parallel
+		int nWritten = 0;
+		StringBuilder sources = new StringBuilder();
 		for (Class clazz : m_VisitedClasses)
 		{
-			PrintStream source = new PrintStream(new FileOutputStream(new File(dst, clazz.getCanonicalName() + ".cpp")));
-			source.format("#include \"API.h\"\n");
+			ByteArrayOutputStream buffer = new ByteArrayOutputStream();
+			PrintStream source = new PrintStream(buffer);
+			// templates may use any class
+			if (new File("templates", clazz.getName() + ".cpp").exists())
+				source.format("#include \"API.h\"\n");
+			else
+			{
+				source.format("#include \"%s.h\"\n", getFileName(clazz));
+				for (Class dependency : getReferencedClasses(clazz))
+					source.format("#include \"%s.h\"\n", getFileName(dependency));
+			}
 			implementClass(source, clazz);
 			source.close();
+			if (writeIfChanged(new File(dst, getFileName(clazz) + ".cpp"), buffer))
+				++nWritten;
+			sources.append(String.format(" \\\n\t%s.cpp", getFileName(clazz)));
 		}
 
-		System.err.println("Creating header file");
-		PrintStream header = new PrintStream(new FileOutputStream(new File(dst, "API.h")));
-		header.format("#pragma once\n");
-		header.format("#include \"APIHelper.h\"\n");
-
-		// Declare classes
-		String currentNameSpace = null;
-		for (Class clazz : m_VisitedClasses)
+		System.err.println("Creating header files");
+		// Declare classes; each header only includes its super class and forward declares the rest
+		StringBuilder umbrella = new StringBuilder();
+		umbrella.append("#pragma once\n");
+		umbrella.append("#include \"APIHelper.h\"\n");
+		for (Class clazz : m_DependencyChain)
 		{
+			ByteArrayOutputStream buffer = new ByteArrayOutputStream();
+			PrintStream header = new PrintStream(buffer);
+			header.format("#pragma once\n");
+			// inline definitions need complete classes; only the outermost generated header
+			// includes them, after its super classes (included below) are declared
+			boolean inline = hasInlineDefinitions(clazz);
+			String outer = "JNI_API_OUTER_" + getFileName(clazz).replace('.', '_');
+			if (inline)
+			{
+				header.format("#ifndef JNI_API_NESTED\n");
+				header.format("#define JNI_API_NESTED\n");
+				header.format("#define %s\n", outer);
+				header.format("#endif\n");
+			}
+			header.format("#include \"APIHelper.h\"\n");
+			Class superClass = getSuperClass(clazz);
+			if (superClass != null)
+				header.format("#include \"%s.h\"\n", getFileName(superClass));
+			header.format("\n");
+
+			// templates may refer to any class
+			Set<Class> dependencies = new File("templates", clazz.getName() + ".h").exists() ? m_DependencyChain : getReferencedClasses(clazz);
+			String currentNameSpace = null;
+			for (Class dependency : dependencies)
+			{
+				if (dependency == clazz)
+					continue;
+				if (dependency == superClass)
+					continue;
+				currentNameSpace = enterNameSpace(header, currentNameSpace, dependency);
+				header.format("struct %s;\n", getSimpleName(dependency));
+			}
 			currentNameSpace = enterNameSpace(header, currentNameSpace, clazz);
-			header.format("struct %s;\n", getSimpleName(clazz));
+			declareClass(header, clazz);
+			closeNameSpace(header, currentNameSpace);
+			if (inline)
+			{
+				header.format("\n#ifdef %s\n", outer);
+				header.format("#undef %s\n", outer);
+				header.format("#undef JNI_API_NESTED\n");
+				header.format("#include \"%s.inl.h\"\n", getFileName(clazz));
+				header.format("#endif\n");
+				if (writeIfChanged(new File(dst, getFileName(clazz) + ".inl.h"), defineInlineMembers(clazz)))
+					++nWritten;
+			}
+			header.close();
+			if (writeIfChanged(new File(dst, getFileName(clazz) + ".h"), buffer))
+				++nWritten;
+			umbrella.append(String.format("#include \"%s.h\"\n", getFileName(clazz)));
 		}
+		if (writeIfChanged(new File(dst, "API.h"), umbrella.toString()))
+			++nWritten;
 
-		// Define classes
-		for (Class clazz : m_DependencyChain)
+		// Makefile fragment listing the generated sources
+		if (writeIfChanged(new File(dst, "API.mk"), String.format("API_SRCS :=%s\n", sources)))
+			++nWritten;
+		System.err.format("%d files updated\n", nWritten);
+	}
+
+	// Hot members of the class or a super class, which are declared inline
+	private boolean hasInlineDefinitions(Class clazz)
+	{
+		for (; clazz != null; clazz = getSuperClass(clazz))
+			if (m_InlineDefinitions.containsKey(clazz))
+				return true;
+		return false;
+	}
+
+	// <class>.inl.h: the hot member definitions of a class and its super classes, with every class they refer to
+	private ByteArrayOutputStream defineInlineMembers(Class clazz) throws Exception
+	{
+		ByteArrayOutputStream buffer = new ByteArrayOutputStream();
+		PrintStream out = new PrintStream(buffer);
+		out.format("#pragma once\n");
+		Class superClass = getSuperClass(clazz);
+		if (superClass != null && hasInlineDefinitions(superClass))
+			out.format("#include \"%s.inl.h\"\n", getFileName(superClass));
+		ByteArrayOutputStream definitions = m_InlineDefinitions.get(clazz);
+		if (definitions != null)
 		{
-			currentNameSpace = enterNameSpace(header, currentNameSpace, clazz);
-			declareClass(header, clazz);
+			// templates may use any class
+			if (new File("templates", clazz.getName() + ".cpp").exists())
+				out.format("#include \"API.h\"\n");
+			else
+				for (Class dependency : getReferencedClasses(clazz))
+					out.format("#include \"%s.h\"\n", getFileName(dependency));
+			out.format("\n");
+			String currentNameSpace = enterNameSpace(out, null, clazz);
+			out.format("%s", definitions.toString());
+			closeNameSpace(out, currentNameSpace);
 		}
-		currentNameSpace = closeNameSpace(header, currentNameSpace);
-		header.close();
+		out.close();
+		return buffer;
+	}
+
+	private String getFileName(Class clazz)
+	{
+		return clazz.getCanonicalName();
+	}
+
+	private Class getSuperClass(Class clazz)
+	{
+		if (isOpaque(clazz))
+			return Object.class;
+		Class superClass = clazz.getSuperclass();
+		if (superClass == null && clazz.isInterface())
+			return Object.class;
+		return superClass;
+	}
+
+	// Every generated class a class' declaration or implementation refers to (itself excluded)
+	private Set<Class> getReferencedClasses(Class clazz) throws Exception
+	{
+		Set<Class> classes = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+		addReferencedClass(classes, getSuperClass(clazz));
+		for (Class superType : getSuperTypes(clazz))
+			addReferencedClass(classes, superType);
+		if (isOpaque(clazz))
+			return classes;
+		for (Class interfaze : clazz.getInterfaces())
+			addReferencedClass(classes, interfaze);
+		for (Field field : getDeclaredFieldsSorted(clazz))
+			if (isValid(field) && isUsed(field))
+				addReferencedClass(classes, field.getType());
+		List<Method> methods = new ArrayList<Method>();
+		for (Method method : getDeclaredMethodsSorted(clazz))
+			if (isValid(method) && (isUsed(method) || clazz.isInterface()))
+				methods.add(method);
+		methods.addAll(Arrays.asList(getNativeMethodsSorted(clazz)));
+		for (Method method : methods)
+		{
+			addReferencedClass(classes, method.getReturnType());
+			for (Class paramType : method.getParameterTypes())
+			{
+				addReferencedClass(classes, paramType);
+				if (clazz.isInterface()) // proxies unbox primitive arguments
+					addReferencedClass(classes, box(paramType));
+			}
+		}
+		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
+			if (isValid(constructor, clazz) && isUsed(constructor))
+				for (Class paramType : constructor.getParameterTypes())
+					addReferencedClass(classes, paramType);
+		classes.remove(clazz);
+		return classes;
+	}
+
+	private void addReferencedClass(Set<Class> classes, Class clazz)
+	{
+		while (clazz != null && clazz.isArray())
+			clazz = clazz.getComponentType();
+		if (clazz != null && m_DependencyChain.contains(clazz))
+			classes.add(clazz);
+	}
+
+	private boolean writeIfChanged(File file, String content) throws IOException
+	{
+		ByteArrayOutputStream buffer = new ByteArrayOutputStream();
+		buffer.write(content.getBytes());
+		return writeIfChanged(file, buffer);
+	}
+
+	// Leave unchanged files (and their timestamps) alone so make only rebuilds what changed
+	private boolean writeIfChanged(File file, ByteArrayOutputStream content) throws IOException
+	{
+		byte[] bytes = content.toByteArray();
+		if (file.isFile() && file.length() == bytes.length)
+		{
+			byte[] existing = new byte[bytes.length];
+			DataInputStream in = new DataInputStream(new FileInputStream(file));
+			try { in.readFully(existing); } finally { in.close(); }
+			if (Arrays.equals(bytes, existing))
+				return false;
+		}
+		FileOutputStream out = new FileOutputStream(file);
+		try { out.write(bytes); } finally { out.close(); }
+		return true;
 	}
 
 	private void declareClass(PrintStream header, Class clazz) throws Exception
@@ -504,20 +1049,194 @@ public class APIGenerator
 		header.format("struct ");
 		header.format("%s : %s", getSimpleName(clazz), getSuperClassName(clazz));
 		header.format("\n{\n");
-		header.format("\tstatic jni::Class __CLASS;\n\n");
+		header.format("\tstatic jni::Class __CLASS;\n");
+		declareTypeHierarchy(header, clazz);
+		declareMirror(header, clazz);
 
 		// Use cast operators for interfaces to avoid deadly diamond of death
-		for (Class interfaze : clazz.getInterfaces())
+		for (Class interfaze : getInterfaces(clazz))
 			header.format("\toperator %s();\n", getClassName(interfaze));
 
 		declareClassMembers(header, clazz);
 
-		if (clazz.isInterface())
+		if (isEnum(clazz))
+			declareEnum(header, clazz);
+
+		if (clazz.isInterface() && !isOpaque(clazz))
 			declareProxy(header, clazz);
 
+		declareNatives(header, clazz);
+
 		header.format("};\n\n");
 	}
 
+	private void declareTypeHierarchy(PrintStream header, Class clazz)
+	{
+/* example ------------------
+	typedef jni::TypeList< ::java::lang::CharSequence, ::java::lang::Comparable, ::java::lang::Object, ::java::io::Serializable > __SUPERTYPES;
+	static constexpr bool __INTERFACE = false, __FINAL = true, __EXACT = true;
+*/
+		StringBuilder types = new StringBuilder();
+		for (Class type : getSuperTypes(clazz))
+			types.append(types.length() == 0 ? " " : ", ").append(getClassName(type));
+		header.format("\ttypedef jni::TypeList<%s%s> __SUPERTYPES;\n", types, types.length() == 0 ? "" : " ");
+		header.format("\tstatic constexpr bool __INTERFACE = %b, __FINAL = %b, __EXACT = %b;\n\n",
+			clazz.isInterface(),
+			!isOpaque(clazz) && Modifier.isFinal(clazz.getModifiers()),
+			isExactHierarchy(clazz));
+	}
+
+	// Every generated super class and interface of a class, transitively
+	private Set<Class> getSuperTypes(Class clazz)
+	{
+		Set<Class> types = new TreeSet<Class>(CLASSNAME_COMPARATOR);
+		LinkedList<Class> pending = new LinkedList<Class>();
+		pending.add(clazz);
+		while (!pending.isEmpty())
+		{
+			Class type = pending.poll();
+			List<Class> supers = new ArrayList<Class>(Arrays.asList(getInterfaces(type)));
+			supers.add(getSuperClass(type));
+			for (Class superType : supers)
+				if (superType != null && m_DependencyChain.contains(superType) && types.add(superType))
+					pending.add(superType);
+		}
+		return types;
+	}
+
+	// False when part of the hierarchy is hidden (opaque or not generated); such a type can't rule out a cast
+	private boolean isExactHierarchy(Class clazz)
+	{
+		if (!m_DependencyChain.contains(clazz) || isOpaque(clazz))
+			return false;
+		for (Class interfaze : clazz.getInterfaces())
+			if (!isExactHierarchy(interfaze))
+				return false;
+		Class superClass = clazz.getSuperclass();
+		return superClass == null || isExactHierarchy(superClass);
+	}
+
+	private boolean isEnum(Class clazz) throws Exception
+	{
+		return clazz.isEnum() && !isOpaque(clazz) && !getEnumConstants(clazz).isEmpty();
+	}
+
+	private void declareEnum(PrintStream header, Class clazz) throws Exception
+	{
+/* example ------------------
+	enum class Enum : ::jint { IDLE = 0, SCANNING = 1 };
+	explicit NetworkInfo_DetailedState(Enum value) : ::java::lang::Enum(__Constant(value)) {}
+	operator Enum() const;
+	static jobject __Constant(Enum value);
+*/
+		List<String> constants = getEnumConstants(clazz);
+		header.format("\tenum class Enum : ::jint {");
+		for (int i = 0; i < constants.size(); ++i)
+			header.format("%s %s = %d", i > 0 ? "," : "", safe(constants.get(i).replace('$', '_'), clazz), i);
+		header.format(" };\n");
+		header.format("\texplicit %s(Enum value) : %s(__Constant(value)) {%s}\n",
+			getSimpleName(clazz),
+			getSuperClassName(clazz),
+			new File("templates", clazz.getName() + ".h").exists() ? " __Initialize(); " : "");
+		header.format("\toperator Enum() const;\n");
+		header.format("\tstatic jobject __Constant(Enum value);\n");
+	}
+
+	private void implementEnum(PrintStream out, Class clazz) throws Exception
+	{
+		List<String> constants = getEnumConstants(clazz);
+		String simpleName = getSimpleName(clazz);
+		out.format("static const char* const s_%sNames[] = {", simpleName);
+		for (int i = 0; i < constants.size(); ++i)
+			out.format("%s \"%s\"", i > 0 ? "," : "", constants.get(i));
+		out.format(" };\n");
+		out.format("static jni::EnumTable s_%sTable(%s::__CLASS, \"()[%s\", s_%sNames, %d);\n",
+			simpleName, simpleName, getSignature(clazz), simpleName, constants.size());
+		out.format("%s::operator %s::Enum() const { return static_cast<Enum>(s_%sTable.Ordinal(m_Object)); }\n", simpleName, simpleName, simpleName);
+		out.format("jobject %s::__Constant(Enum value) { return s_%sTable.Constant(static_cast< ::jint >(value)); }\n", simpleName, simpleName);
+	}
+
+	// Primitive instance fields of a --mirror class and its super classes; hidden fields are left out
+	private List<Field> getMirrorFields(Class clazz)
+	{
+		LinkedList<Field> fields = new LinkedList<Field>();
+		if (m_MirroredClasses == null || clazz.isInterface() || isOpaque(clazz) || !m_MirroredClasses.matcher(getClassName(clazz)).matches())
+			return fields;
+		Set<String> names = new HashSet<String>();
+		for (Class type = clazz; type != null; type = type.getSuperclass())
+		{
+			LinkedList<Field> declared = new LinkedList<Field>();
+			for (Field field : getDeclaredFieldsSorted(type))
+				if (isValid(field) && !isStatic(field) && field.getType().isPrimitive() && names.add(field.getName()))
+					declared.add(field);
+			fields.addAll(0, declared);
+		}
+		return fields;
+	}
+
+	private String getMirrorFieldName(Field field)
+	{
+		return safe(field.getName().replace('$', '_'), field.getDeclaringClass());
+	}
+
+	private void declareMirror(PrintStream header, Class clazz) throws Exception
+	{
+		List<Field> fields = getMirrorFields(clazz);
+		if (fields.isEmpty())
+			return;
+/* example ------------------
+	struct __Mirror
+	{
+		::jint x;
+		::jint y;
+	};
+	__Mirror __Snapshot() const;
+	void __WriteBack(const __Mirror& mirror) const;
+	static bool __Snapshot(const jni::Array< ::java::awt::Point >& objects, __Mirror* mirrors);
+	static bool __WriteBack(const jni::Array< ::java::awt::Point >& objects, const __Mirror* mirrors);
+*/
+		header.format("\tstruct __Mirror\n");
+		header.format("\t{\n");
+		for (Field field : fields)
+			header.format("\t\t%s %s;\n", getClassName(field.getType()), getMirrorFieldName(field));
+		header.format("\t};\n");
+		header.format("\t__Mirror __Snapshot() const;\n");
+		header.format("\tvoid __WriteBack(const __Mirror& mirror) const;\n");
+		header.format("\tstatic bool __Snapshot(const jni::Array< %s >& objects, __Mirror* mirrors);\n", getClassName(clazz));
+		header.format("\tstatic bool __WriteBack(const jni::Array< %s >& objects, const __Mirror* mirrors);\n\n", getClassName(clazz));
+	}
+
+	private void implementMirror(PrintStream out, Class clazz) throws Exception
+	{
+		List<Field> fields = getMirrorFields(clazz);
+		if (fields.isEmpty())
+			return;
+/* example ------------------
+static const jni::MirrorField s_PointMirrorFields[] = { { "x", 'I', offsetof(Point::__Mirror, x) }, { "y", 'I', offsetof(Point::__Mirror, y) } };
+static jni::MirrorLayout s_PointMirror(Point::__CLASS, s_PointMirrorFields, 2, sizeof(Point::__Mirror));
+*/
+		String simpleName = getSimpleName(clazz);
+		out.format("static const jni::MirrorField s_%sMirrorFields[] = {", simpleName);
+		for (int i = 0; i < fields.size(); ++i)
+			out.format("%s { \"%s\", '%s', offsetof(%s::__Mirror, %s) }",
+				i > 0 ? "," : "",
+				fields.get(i).getName(),
+				getSignature(fields.get(i).getType()),
+				simpleName,
+				getMirrorFieldName(fields.get(i)));
+		out.format(" };\n");
+		out.format("static jni::MirrorLayout s_%sMirror(%s::__CLASS, s_%sMirrorFields, %d, sizeof(%s::__Mirror));\n",
+			simpleName, simpleName, simpleName, fields.size(), simpleName);
+		out.format("%s::__Mirror %s::__Snapshot() const { __Mirror mirror = __Mirror(); s_%sMirror.Snapshot(m_Object, &mirror); return mirror; }\n",
+			simpleName, simpleName, simpleName);
+		out.format("void %s::__WriteBack(const __Mirror& mirror) const { s_%sMirror.WriteBack(m_Object, &mirror); }\n",
+			simpleName, simpleName);
+		out.format("bool %s::__Snapshot(const jni::Array< %s >& objects, __Mirror* mirrors) { return s_%sMirror.Snapshot(objects, mirrors); }\n",
+			simpleName, getClassName(clazz), simpleName);
+		out.format("bool %s::__WriteBack(const jni::Array< %s >& objects, const __Mirror* mirrors) { return s_%sMirror.WriteBack(objects, mirrors); }\n",
+			simpleName, getClassName(clazz), simpleName);
+	}
+
 	private void declareProxy(PrintStream header, Class clazz) throws Exception
 	{
 		header.format("\tstruct __Proxy : public virtual jni::ProxyInvoker\n");
@@ -545,6 +1264,43 @@ public class APIGenerator
 		}
 	}
 
+	private void declareNatives(PrintStream header, Class clazz) throws Exception
+	{
+		Method[] methods = getNativeMethodsSorted(clazz);
+		if (methods.length == 0)
+			return;
+/* example ------------------
+	struct __Natives
+	{
+		static bool __Register();
+		static ::jint NativeRead(const ::java::io::FileDescriptor& __this, const jni::Array< ::jbyte >& arg0);
+	};
+*/
+		header.format("\tstruct __Natives\n");
+		header.format("\t{\n");
+		header.format("\t\tstatic bool __Register();\n");
+		for (Method method : methods)
+			header.format("\t\tstatic %s %s(%s);\n",
+				getNativeReturnType(method),
+				getMethodName(method),
+				getNativeParameterSignature(method));
+		header.format("\t};\n");
+	}
+
+	private String getNativeReturnType(Method method)
+	{
+		return method.getReturnType() == void.class ? "void" : getClassName(method.getReturnType());
+	}
+
+	private String getNativeParameterSignature(Method method)
+	{
+		String params = getParameterSignature(method.getParameterTypes());
+		if (isStatic(method))
+			return params;
+		String self = String.format("const %s& __this", getClassName(method.getDeclaringClass()));
+		return params.isEmpty() ? self : self + ", " + params;
+	}
+
 	private void declareClassMembers(PrintStream out, Class clazz) throws Exception
 	{
 		File templateFile = new File("templates", clazz.getName() + ".h");
@@ -555,10 +1311,17 @@ public class APIGenerator
 */
 		for (Field field : getDeclaredFieldsSorted(clazz))
 		{
-			if (!isValid(field))
+			if (!isValid(field) || !isUsed(field))
 				continue;
-			out.format("\t%s%s%s %s()%s;\n",
+			String constant = getConstantLiteral(field);
+			if (constant != null)
+			{
+				out.format("\tstatic constexpr %s %s() { return %s; }\n", getClassName(field.getType()), getFieldName(field), constant);
+				continue;
+			}
+			out.format("\t%s%s%s%s %s()%s;\n",
 				isStatic(field) ? "static " : "",
+				isHot(field) ? "inline " : "",
 				getClassName(field.getType()),
 				isStaticFinal(field) ? "&" : "",
 				getFieldName(field),
@@ -566,8 +1329,9 @@ public class APIGenerator
 
 			if (isFinal(field))
 				continue;
-			out.format("\t%svoid %s(%s)%s;\n",
+			out.format("\t%s%svoid %s(%s)%s;\n",
 				isStatic(field) ? "static " : "",
+				isHot(field) ? "inline " : "",
 				getFieldName(field),
 				getParameterSignature(new Class[] {field.getType()}),
 				isStatic(field) ? "" : " const");
@@ -577,10 +1341,11 @@ public class APIGenerator
 */
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
-			if (!isValid(method))
+			if (!isValid(method) || !isUsed(method))
 				continue;
-			out.format("\t%s%s %s(%s)%s;\n",
+			out.format("\t%s%s%s %s(%s)%s;\n",
 				isStatic(method) ? "static " : "",
+				isHot(method) ? "inline " : "",
 				getClassName(method.getReturnType()),
 				getMethodName(method),
 				getParameterSignature(method.getParameterTypes()),
@@ -592,7 +1357,7 @@ public class APIGenerator
 */
 		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
 		{
-			if (!isValid(constructor, clazz))
+			if (!isValid(constructor, clazz) || !isUsed(constructor))
 				continue;
 			Class[] params = constructor.getParameterTypes();
 			out.format("\tstatic jobject __Constructor(%s);\n", getParameterSignature(params));
@@ -627,7 +1392,7 @@ public class APIGenerator
 		String namespace = enterNameSpace(out, null, clazz);
 		out.format("jni::Class %s::__CLASS(\"%s\");\n\n", getSimpleName(clazz), clazz.getName().replace('.', '/'));
 
-		for (Class interfaze : clazz.getInterfaces())
+		for (Class interfaze : getInterfaces(clazz))
 			out.format("%s::operator %s() { return %s((jobject)*this); }\n", getSimpleName(clazz), getClassName(interfaze), getClassName(interfaze));
 
 		implementClassMembers(out, clazz);
@@ -637,12 +1402,83 @@ public class APIGenerator
 		if (tempalteFile.exists())
 			out.format("%s\n",	new Scanner(tempalteFile).useDelimiter("\\Z").next());
 
-		if (clazz.isInterface())
+		if (isEnum(clazz))
+			implementEnum(out, clazz);
+
+		implementMirror(out, clazz);
+
+		if (clazz.isInterface() && !isOpaque(clazz))
 			implementProxy(out, clazz);
 
+		implementNatives(out, clazz);
+
 		closeNameSpace(out, namespace);
 	}
 
+	private void implementNatives(PrintStream out, Class clazz) throws Exception
+	{
+		Method[] methods = getNativeMethodsSorted(clazz);
+		if (methods.length == 0)
+			return;
+/* example ------------------
+static ::jint JNICALL __Native_0(JNIEnv*, jobject __this, jobject arg0)
+{
+	return FileInputStream::__Natives::NativeRead(FileInputStream(__this), jni::Array< ::jbyte >(arg0));
+}
+*/
+		for (int i = 0; i < methods.length; ++i)
+		{
+			Method method = methods[i];
+			Class returnType = method.getReturnType();
+			Class[] params = method.getParameterTypes();
+			StringBuilder jniParams = new StringBuilder(isStatic(method) ? "JNIEnv*, jclass" : "JNIEnv*, jobject __this");
+			StringBuilder args = new StringBuilder(isStatic(method) ? "" : getSimpleName(clazz) + "(__this)");
+			for (int j = 0; j < params.length; ++j)
+			{
+				jniParams.append(String.format(", %s arg%d", params[j].isPrimitive() ? getClassName(params[j]) : "jobject", j));
+				if (args.length() > 0)
+					args.append(", ");
+				args.append(params[j].isPrimitive() ? "arg" + j : String.format("%s(arg%d)", getClassName(params[j]), j));
+			}
+			String call = String.format("%s::__Natives::%s(%s)", getSimpleName(clazz), getMethodName(method), args);
+
+			out.format("static %s JNICALL __Native_%d(%s)\n",
+				returnType == void.class ? "void" : returnType.isPrimitive() ? getClassName(returnType) : "jobject",
+				i,
+				jniParams);
+			out.format("{\n");
+			if (returnType == void.class)
+				out.format("\t%s;\n", call);
+			else if (returnType.isPrimitive())
+				out.format("\treturn %s;\n", call);
+			else
+				out.format("\treturn jni::NewLocalRef(static_cast<jobject>(%s));\n", call);
+			out.format("}\n");
+		}
+/* example ------------------
+bool FileInputStream::__Natives::__Register()
+{
+	static JNINativeMethod methods[] = {
+		{ const_cast<char*>("nativeRead"), const_cast<char*>("([B)I"), reinterpret_cast<void*>(__Native_0) },
+	};
+	jni::RegisterNatives(__CLASS, methods, sizeof(methods) / sizeof(methods[0]));
+	return !jni::CheckError();
+}
+*/
+		out.format("bool %s::__Natives::__Register()\n", getSimpleName(clazz));
+		out.format("{\n");
+		out.format("\tstatic JNINativeMethod methods[] = {\n");
+		for (int i = 0; i < methods.length; ++i)
+			out.format("\t\t{ const_cast<char*>(\"%s\"), const_cast<char*>(\"%s\"), reinterpret_cast<void*>(__Native_%d) },\n",
+				methods[i].getName(),
+				getSignature(methods[i]),
+				i);
+		out.format("\t};\n");
+		out.format("\tjni::RegisterNatives(__CLASS, methods, sizeof(methods) / sizeof(methods[0]));\n");
+		out.format("\treturn !jni::CheckError();\n");
+		out.format("}\n");
+	}
+
 	private void implementProxy(PrintStream out, Class clazz) throws Exception
 	{
 		out.format("%s::__Proxy::operator %s() { return %s(static_cast<jobject>(__ProxyObject())); }\n", getSimpleName(clazz), getSimpleName(clazz), getSimpleName(clazz));
@@ -682,22 +1518,30 @@ public class APIGenerator
 				continue;
 			Class returnType = method.getReturnType();
 			Class[] params = method.getParameterTypes();
-			if (returnType != void.class)
-				out.format("\tif (methodIDs[%d] == methodID) { *result = jni::NewLocalRef(static_cast< %s >(%s(%s))); *success = true; return true; }\n",
+			if (returnType.isPrimitive() && returnType != void.class)
+				out.format("\tif (methodIDs[%d] == methodID) { *result = jni::Box(%s(%s)); *success = true; return true; }\n",
 					i++,
-					getClassName(box(returnType)),
 					getMethodName(method),
 					getParametersFromJNIObjectArray(params));
-			else
-				out.format("\tif (methodIDs[%d] == methodID) { *result = NULL; %s(%s); *success = true; return true; }\n",
+			else if (returnType != void.class)
+				out.format("\tif (methodIDs[%d] == methodID) { *result = jni::NewLocalRef(static_cast< %s >(%s(%s))); *success = true; return true; }\n",
 					i++,
+					getClassName(returnType),
 					getMethodName(method),
 					getParametersFromJNIObjectArray(params));
+			else // void callbacks may be queued when the proxy is dispatching asynchronously
+				out.format("\tif (methodIDs[%d] == methodID) { *result = NULL; %sif (__Async()) __Post([=]() { %s(%s); }); else %s(%s); *success = true; return true; }\n",
+					i++,
+					getParameterLocalsFromJNIObjectArray(params),
+					getMethodName(method),
+					getParameterNames(params.length),
+					getMethodName(method),
+					getParameterNames(params.length));
 		}
 		out.format("\treturn false;\n}");
 	}
 
-	private void implementClassMembers(PrintStream out, Class clazz) throws Exception
+	private void implementClassMembers(PrintStream cold, Class clazz) throws Exception
 	{
 /* example ------------------
 ::java::util::Comparator& String::fCASE_INSENSITIVE_ORDER()
@@ -709,45 +1553,71 @@ public class APIGenerator
 */
 		for (Field field : getDeclaredFieldsSorted(clazz))
 		{
-			if (!isValid(field))
+			if (!isValid(field) || !isUsed(field) || getConstantLiteral(field) != null)
 				continue;
-			out.format("%s%s %s::%s()%s\n",
+			// hot members are defined inline (<class>.inl.h) with pre-resolved id slots
+			boolean hot = isHot(field);
+			PrintStream out = hot ? getInlineStream(clazz) : cold;
+			String fieldID = hot ? String.format("slot.Get%s(__CLASS)", isStatic(field) ? "Static" : "") : "fieldID";
+			out.format("%s%s%s %s::%s()%s\n",
+				hot ? "inline " : "",
 				getClassName(field.getType()),
 				isStaticFinal(field) ? "&" : "",
 				getSimpleName(clazz),
 				getFieldName(field),
 				isStatic(field) ? "" : " const");
 			out.format("{\n");
-			out.format("\tstatic jfieldID fieldID = jni::Get%sFieldID(__CLASS, \"%s\", \"%s\");\n",
-				isStatic(field) ? "Static" : "",
-				field.getName(),
-				getSignature(field));
-			out.format("\t%s%s val = %s(jni::Op<%s>::Get%sField(%s, fieldID));\n",
-				isStaticFinal(field) ? "static " : "",
-				getClassName(field.getType()),
+			if (hot)
+				out.format("\tstatic jni::FieldSlot slot = { \"%s\", \"%s\", 0 };\n",
+					field.getName(),
+					getSignature(field));
+			else
+				out.format("\tstatic jfieldID fieldID = jni::Get%sFieldID(__CLASS, \"%s\", \"%s\");\n",
+					isStatic(field) ? "Static" : "",
+					field.getName(),
+					getSignature(field));
+			String get = String.format("%s(jni::Op<%s>::Get%sField(%s, %s))",
 				getClassName(field.getType()),
 				getPrimitiveType(field.getType()),
 				isStatic(field) ? "Static" : "",
-				isStatic(field) ? "__CLASS" : "m_Object");
-			out.format("\treturn val;\n");
+				isStatic(field) ? "__CLASS" : "m_Object",
+				fieldID);
+			Long ttl = isStaticFinal(field) ? null : getMemoTtl(field);
+			if (ttl != null)
+				implementMemo(out, field.getType(), ttl, isStatic(field), get);
+			else
+			{
+				out.format("\t%s%s val = %s;\n",
+					isStaticFinal(field) ? "static " : "",
+					getClassName(field.getType()),
+					get);
+				out.format("\treturn val;\n");
+			}
 			out.format("}\n");
 
 			if (isFinal(field))
 				continue;
-			out.format("void %s::%s(%s)%s\n",
+			out.format("%svoid %s::%s(%s)%s\n",
+				hot ? "inline " : "",
 				getSimpleName(clazz),
 				getFieldName(field),
 				getParameterSignature(new Class[] {field.getType()}),
 				isStatic(field) ? "" : " const");
 			out.format("{\n");
-			out.format("\tstatic jfieldID fieldID = jni::Get%sFieldID(__CLASS, \"%s\", \"%s\");\n",
-				isStatic(field) ? "Static" : "",
-				field.getName(),
-				getSignature(field));
-			out.format("\tjni::Op<%s>::Set%sField(%s, fieldID%s);\n",
+			if (hot)
+				out.format("\tstatic jni::FieldSlot slot = { \"%s\", \"%s\", 0 };\n",
+					field.getName(),
+					getSignature(field));
+			else
+				out.format("\tstatic jfieldID fieldID = jni::Get%sFieldID(__CLASS, \"%s\", \"%s\");\n",
+					isStatic(field) ? "Static" : "",
+					field.getName(),
+					getSignature(field));
+			out.format("\tjni::Op<%s>::Set%sField(%s, %s%s);\n",
 				getPrimitiveType(field.getType()),
 				isStatic(field) ? "Static" : "",
 				isStatic(field) ? "__CLASS" : "m_Object",
+				fieldID,
 				getParameterJNINames(new Class[] {field.getType()}));
 			out.format("}\n");
 
@@ -756,32 +1626,49 @@ public class APIGenerator
 /* example ------------------
 jni::Array< ::java::lang::String > String::Split(const ::java::lang::String& arg0, const ::jint& arg1) const
 {
-	static jmethodID methodID = jni::GetMethodID(__CLASS, "split", "(Ljava/lang/String;I)[Ljava/lang/String;");
-	return jni::Array< ::java::lang::String >(jni::Op<jobjectArray>::CallMethod(m_Object, methodID, (jobject)arg0, arg1));
+	static jni::MethodSlot slot = { "split", "(Ljava/lang/String;I)[Ljava/lang/String;", 0 };
+	return jni::Array< ::java::lang::String >(jni::Call<jobject>::Method(__CLASS, &slot, m_Object, (jobject)arg0, arg1));
 }
 */
 		for (Method method : getDeclaredMethodsSorted(clazz))
 		{
-			if (!isValid(method))
+			if (!isValid(method) || !isUsed(method))
 				continue;
+			boolean hot = isHot(method);
+			PrintStream out = hot ? getInlineStream(clazz) : cold;
 			Class[] params = method.getParameterTypes();
-			out.format("%s %s::%s(%s)%s\n",
+			out.format("%s%s %s::%s(%s)%s\n",
+				hot ? "inline " : "",
 				getClassName(method.getReturnType()),
 				getSimpleName(clazz),
 				getMethodName(method),
 				getParameterSignature(params),
 				isStatic(method) ? "" : " const");
 			out.format("{\n");
-			out.format("\tstatic jmethodID methodID = jni::Get%sMethodID(__CLASS, \"%s\", \"%s\");\n",
-				isStatic(method) ? "Static" : "",
+			out.format("\tstatic jni::MethodSlot slot = { \"%s\", \"%s\", 0 };\n",
 				method.getName(),
 				getSignature(method));
-			out.format("\treturn %s(jni::Op<%s>::Call%sMethod(%s, methodID%s));\n",
-				getClassName(method.getReturnType()),
-				getPrimitiveType(method.getReturnType()),
-				isStatic(method) ? "Static" : "",
-				isStatic(method) ? "__CLASS" : "m_Object",
-				getParameterJNINames(params));
+			String call;
+			if (hot) // direct, inlinable call path
+				call = String.format("%s(jni::Op<%s>::Call%sMethod(%s, slot.Get%s(__CLASS)%s))",
+					getClassName(method.getReturnType()),
+					getPrimitiveType(method.getReturnType()),
+					isStatic(method) ? "Static" : "",
+					isStatic(method) ? "__CLASS" : "m_Object",
+					isStatic(method) ? "Static" : "",
+					getParameterJNINames(params));
+			else // shared out-of-line stub per return kind
+				call = String.format("%s(jni::Call<%s>::%s(__CLASS, &slot%s%s))",
+					getClassName(method.getReturnType()),
+					method.getReturnType().isPrimitive() ? getPrimitiveType(method.getReturnType()) : "jobject",
+					isStatic(method) ? "StaticMethod" : "Method",
+					isStatic(method) ? "" : ", m_Object",
+					getParameterJNINames(params));
+			Long ttl = getMemoTtl(method);
+			if (ttl != null)
+				implementMemo(out, method.getReturnType(), ttl, isStatic(method), call);
+			else
+				out.format("\treturn %s;\n", call);
 			out.format("}\n");
 		}
 
@@ -794,16 +1681,164 @@ jobject String::__Constructor(const jni::Array< ::jbyte >& arg0, const ::jint& a
 */
 		for (Constructor constructor : getDeclaredConstructorsSorted(clazz))
 		{
-			if (!isValid(constructor, clazz))
+			if (!isValid(constructor, clazz) || !isUsed(constructor))
 				continue;
 			Class[] params = constructor.getParameterTypes();
-			out.format("jobject %s::__Constructor(%s)\n", getSimpleName(clazz), getParameterSignature(params));
-			out.format("{\n");
-			out.format("\tstatic jmethodID constructorID = jni::GetMethodID(__CLASS, \"<init>\", \"%s\");\n",
+			cold.format("jobject %s::__Constructor(%s)\n", getSimpleName(clazz), getParameterSignature(params));
+			cold.format("{\n");
+			cold.format("\tstatic jmethodID constructorID = jni::GetMethodID(__CLASS, \"<init>\", \"%s\");\n",
 				getSignature(constructor));
-			out.format("\treturn jni::NewObject(__CLASS, constructorID%s);\n",
+			cold.format("\treturn jni::NewObject(__CLASS, constructorID%s);\n",
 				getParameterJNINames(params));
-			out.format("}\n");
+			cold.format("}\n");
+		}
+	}
+
+/* example ------------------
+	static jni::Memo< ::jint > memo(0);
+	return memo.Get(m_Object, [&]() { return ::jint(jni::Call<jint>::Method(__CLASS, &slot, m_Object)); });
+*/
+	private void implementMemo(PrintStream out, Class type, long ttl, boolean isStatic, String expression)
+	{
+		out.format("\tstatic jni::Memo< %s > memo(%d);\n", getClassName(type), ttl);
+		out.format("\treturn memo.Get(%s, [&]() { return %s; });\n", isStatic ? "0" : "m_Object", expression);
+	}
+
+	// Inline definitions of a class' hot members; written to <class>.inl.h
+	private PrintStream getInlineStream(Class clazz)
+	{
+		ByteArrayOutputStream buffer = m_InlineDefinitions.get(clazz);
+		if (buffer == null)
+		{
+			buffer = new ByteArrayOutputStream();
+			m_InlineDefinitions.put(clazz, buffer);
+		}
+		return new PrintStream(buffer);
+	}
+
+	// C++ literal of a primitive compile time constant (ConstantValue attribute), null otherwise.
+	// String constants keep their accessor; a java.lang.String can't be constexpr.
+	private String getConstantLiteral(Field field) throws IOException
+	{
+		Class type = field.getType();
+		if (!isStaticFinal(field) || !type.isPrimitive())
+			return null;
+		Object value = getConstantValues(field.getDeclaringClass()).get(field.getName());
+		if (value == null)
+			return null;
+
+		if (type == boolean.class)
+			return ((Integer) value) != 0 ? "true" : "false";
+		if (type == long.class)
+		{
+			long l = (Long) value;
+			return l == Long.MIN_VALUE ? "(-9223372036854775807LL - 1)" : l + "LL";
+		}
+		if (type == float.class)
+		{
+			float f = (Float) value;
+			if (Float.isNaN(f))			return "__builtin_nanf(\"\")";
+			if (Float.isInfinite(f))	return f > 0 ? "__builtin_inff()" : "-__builtin_inff()";
+			return Float.toString(f) + "f";
+		}
+		if (type == double.class)
+		{
+			double d = (Double) value;
+			if (Double.isNaN(d))		return "__builtin_nan(\"\")";
+			if (Double.isInfinite(d))	return d > 0 ? "__builtin_inf()" : "-__builtin_inf()";
+			return Double.toString(d);
+		}
+		int i = (Integer) value; // byte, short, char and int
+		return i == Integer.MIN_VALUE ? "(-2147483647 - 1)" : Integer.toString(i);
+	}
+
+	// ConstantValue attributes of a class' fields, read from the class file (reflection would run <clinit>)
+	private Map<String, Object> getConstantValues(Class clazz) throws IOException
+	{
+		if (!m_ConstantValues.containsKey(clazz))
+			parseClassFile(clazz);
+		return m_ConstantValues.get(clazz);
+	}
+
+	// Enum constant names in declaration (= ordinal) order, read from the class file
+	private List<String> getEnumConstants(Class clazz) throws IOException
+	{
+		if (!m_EnumConstants.containsKey(clazz))
+			parseClassFile(clazz);
+		return m_EnumConstants.get(clazz);
+	}
+
+	private void parseClassFile(Class clazz) throws IOException
+	{
+		Map<String, Object> values = new HashMap<String, Object>();
+		List<String> enumConstants = new ArrayList<String>();
+		m_ConstantValues.put(clazz, values);
+		m_EnumConstants.put(clazz, enumConstants);
+
+		InputStream stream = m_ClassLoader != null ? m_ClassLoader.getResourceAsStream(clazz.getName().replace('.', '/') + ".class") : null;
+		if (stream == null)
+			return;
+
+		DataInputStream in = new DataInputStream(new BufferedInputStream(stream));
+		try
+		{
+			in.readInt();				// magic
+			in.readUnsignedShort();		// minor
+			in.readUnsignedShort();		// major
+			int nConstants = in.readUnsignedShort();
+			Object[] constants = new Object[nConstants];
+			for (int i = 1; i < nConstants; ++i)
+			{
+				int tag = in.readUnsignedByte();
+				switch (tag)
+				{
+					case 1:	constants[i] = in.readUTF(); break;				// Utf8
+					case 3:	constants[i] = in.readInt(); break;				// Integer
+					case 4:	constants[i] = in.readFloat(); break;			// Float
+					case 5:	constants[i] = in.readLong(); ++i; break;		// Long (two slots)
+					case 6:	constants[i] = in.readDouble(); ++i; break;		// Double (two slots)
+					case 7: case 8: case 16: case 19: case 20:				// Class, String, MethodType, Module, Package
+						in.readUnsignedShort(); break;
+					case 9: case 10: case 11: case 12: case 17: case 18:	// refs, NameAndType, Dynamic, InvokeDynamic
+						in.readInt(); break;
+					case 15: in.readUnsignedByte(); in.readUnsignedShort(); break; // MethodHandle
+					default: throw new IOException(clazz.getName() + ": unknown constant pool tag " + tag);
+				}
+			}
+			in.readUnsignedShort();		// access flags
+			in.readUnsignedShort();		// this class
+			in.readUnsignedShort();		// super class
+			int nInterfaces = in.readUnsignedShort();
+			for (int i = 0; i < nInterfaces; ++i)
+				in.readUnsignedShort();
+
+			int nFields = in.readUnsignedShort();
+			for (int i = 0; i < nFields; ++i)
+			{
+				int access = in.readUnsignedShort();
+				Object name = constants[in.readUnsignedShort()];
+				if ((access & 0x4000) != 0) // ACC_ENUM
+					enumConstants.add((String) name);
+				in.readUnsignedShort();	// descriptor
+				int nAttributes = in.readUnsignedShort();
+				for (int j = 0; j < nAttributes; ++j)
+				{
+					Object attribute = constants[in.readUnsignedShort()];
+					int length = in.readInt();
+					if ("ConstantValue".equals(attribute))
+					{
+						Object value = constants[in.readUnsignedShort()];
+						if (value != null)
+							values.put((String) name, value);
+					}
+					else
+						in.readFully(new byte[length]);
+				}
+			}
+		}
+		finally
+		{
+			in.close();
 		}
 	}
 
@@ -828,6 +1863,23 @@ jobject String::__Constructor(const jni::Array< ::jbyte >& arg0, const ::jint& a
 		return methods;
 	}
 
+	private Class[] getInterfaces(Class clazz)
+	{
+		return isOpaque(clazz) ? new Class[0] : clazz.getInterfaces();
+	}
+
+	public Method[] getNativeMethodsSorted(Class clazz)
+	{
+		LinkedList<Method> natives = new LinkedList<Method>();
+		if (m_NativeClasses != null && !isOpaque(clazz) && m_NativeClasses.matcher(getClassName(clazz)).matches())
+		{
+			for (Method method : getDeclaredMethodsSorted(clazz))
+				if (isNative(method) && !method.isSynthetic())
+					natives.add(method);
+		}
+		return natives.toArray(new Method[natives.size()]);
+	}
+
 	private static class ByNameAndSignature<T extends Member> implements Comparator<T>
 	{
 		@Override
@@ -1,7 +1,11 @@
 #include "APIHelper.h"
+#include "API.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
 
 namespace jni
 {
@@ -17,7 +21,529 @@ Class::~Class()
 	free(m_ClassName);
 }
 
+// --------------------------------------------------------------------------------------
+// Shared call stubs
+// --------------------------------------------------------------------------------------
+jmethodID MethodSlot::Resolve(Class& clazz, bool isStatic)
+{
+	// racing threads resolve the same id
+	jmethodID m = isStatic ? jni::GetStaticMethodID(clazz, name, signature) : jni::GetMethodID(clazz, name, signature);
+	__atomic_store_n(&id, m, __ATOMIC_RELAXED);
+	return m;
+}
+
+jfieldID FieldSlot::Resolve(Class& clazz, bool isStatic)
+{
+	jfieldID f = isStatic ? jni::GetStaticFieldID(clazz, name, signature) : jni::GetFieldID(clazz, name, signature);
+	__atomic_store_n(&id, f, __ATOMIC_RELAXED);
+	return f;
+}
+
+template <typename JT>
+JT Call<JT>::Method(Class& clazz, MethodSlot* slot, jobject object, ...)
+{
+	jmethodID id = slot->Get(clazz);
+	va_list args;
+	va_start(args, object);
+	JT result = jni::Op<JT>::CallMethodV(object, id, args);
+	va_end(args);
+	return result;
+}
+
+template <typename JT>
+JT Call<JT>::StaticMethod(Class& clazz, MethodSlot* slot, ...)
+{
+	jmethodID id = slot->GetStatic(clazz);
+	va_list args;
+	va_start(args, slot);
+	JT result = jni::Op<JT>::CallStaticMethodV(clazz, id, args);
+	va_end(args);
+	return result;
+}
+
+template class Call<jvoid>;
+template class Call<jobject>;
+template class Call<jboolean>;
+template class Call<jbyte>;
+template class Call<jchar>;
+template class Call<jshort>;
+template class Call<jint>;
+template class Call<jlong>;
+template class Call<jfloat>;
+template class Call<jdouble>;
+
+// --------------------------------------------------------------------------------------
+// Memoization
+// --------------------------------------------------------------------------------------
+static volatile int s_MemoGeneration = 0;
+
+static jlong MonotonicMillis()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<jlong>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void InvalidateMemos()
+{
+	__sync_add_and_fetch(&s_MemoGeneration, 1);
+}
+
+MemoBase::MemoBase(jlong ttl) : m_Ttl(ttl), m_Expires(0), m_Generation(-1), m_Receiver(0), m_Lock(0)
+{
+}
+
+MemoBase::~MemoBase()
+{
+	if (m_Receiver)
+		jni::DeleteWeakGlobalRef(m_Receiver);
+}
+
+void MemoBase::Lock()
+{
+	while (__sync_lock_test_and_set(&m_Lock, 1))
+		sched_yield();
+}
+
+bool MemoBase::IsValid(jobject receiver)
+{
+	if (m_Generation != Generation())
+		return false;
+	if (m_Ttl > 0 && MonotonicMillis() >= m_Expires)
+		return false;
+	if (!receiver)
+		return true;
+	// a collected receiver's weak ref isn't the same as any live object
+	return m_Receiver && jni::IsSameObject(m_Receiver, receiver);
+}
+
+int MemoBase::Generation()
+{
+	return __atomic_load_n(&s_MemoGeneration, __ATOMIC_ACQUIRE);
+}
+
+void MemoBase::Validate(jobject receiver, int generation)
+{
+	m_Generation = generation;
+	m_Expires = m_Ttl > 0 ? MonotonicMillis() + m_Ttl : 0;
+	if (m_Receiver)
+		jni::DeleteWeakGlobalRef(m_Receiver);
+	m_Receiver = receiver ? jni::NewWeakGlobalRef(receiver) : 0;
+}
+
+// --------------------------------------------------------------------------------------
+// Enum Support
+// --------------------------------------------------------------------------------------
+enum { kEnumUninitialized = 0, kEnumInitializing, kEnumInitialized };
+
+static Class s_EnumClass("java/lang/Enum");
+
+EnumTable::EnumTable(Class& clazz, const char* valuesSignature, const char* const* names, jint count)
+	: m_Class(clazz), m_ValuesSignature(valuesSignature), m_Names(names), m_Count(count), m_Constants(0), m_State(kEnumUninitialized)
+{
+}
+
+EnumTable::~EnumTable()
+{
+	if (m_Constants)
+	{
+		for (jint i = 0; i < m_Count; ++i)
+			if (m_Constants[i])
+				jni::DeleteGlobalRef(m_Constants[i]);
+		free(m_Constants);
+	}
+}
+
+// Fetches values() once and keeps a global ref to every constant, indexed by native ordinal
+bool EnumTable::Initialize()
+{
+	int state = __atomic_load_n(&m_State, __ATOMIC_ACQUIRE);
+	while (state != kEnumInitialized)
+	{
+		if (state == kEnumUninitialized && __sync_bool_compare_and_swap(&m_State, kEnumUninitialized, kEnumInitializing))
+			break;
+		sched_yield();
+		state = __atomic_load_n(&m_State, __ATOMIC_ACQUIRE);
+	}
+	if (state == kEnumInitialized)
+		return true;
+
+	LocalFrame frame;
+	jobject* constants = static_cast<jobject*>(calloc(m_Count, sizeof(jobject)));
+	jmethodID valuesMID = jni::GetStaticMethodID(m_Class, "values", m_ValuesSignature);
+	jmethodID nameMID   = jni::GetMethodID(s_EnumClass, "name", "()Ljava/lang/String;");
+	jobjectArray values = jni::Op<jobjectArray>::CallStaticMethod(m_Class, valuesMID);
+	size_t nValues = values ? jni::GetArrayLength(values) : 0;
+	for (size_t i = 0; i < nValues; ++i)
+	{
+		jobject value = jni::GetObjectArrayElement(values, i);
+		jstring name = static_cast<jstring>(jni::Op<jobject>::CallMethod(value, nameMID));
+		const char* chars = name ? jni::GetStringUTFChars(name) : 0;
+		for (jint ordinal = 0; chars && ordinal < m_Count; ++ordinal)
+		{
+			if (!constants[ordinal] && !strcmp(chars, m_Names[ordinal]))
+			{
+				constants[ordinal] = jni::NewGlobalRef(value);
+				break;
+			}
+		}
+		if (chars)
+			jni::ReleaseStringUTFChars(name, chars);
+	}
+
+	// Leave it uninitialized on failure so the next use tries again
+	bool initialized = values && !jni::PeekError();
+	if (initialized)
+		m_Constants = constants;
+	else
+	{
+		for (jint i = 0; i < m_Count; ++i)
+			if (constants[i])
+				jni::DeleteGlobalRef(constants[i]);
+		free(constants);
+	}
+	__atomic_store_n(&m_State, initialized ? kEnumInitialized : kEnumUninitialized, __ATOMIC_RELEASE);
+	return initialized;
+}
+
+jint EnumTable::Ordinal(jobject value)
+{
+	if (!value || !Initialize())
+		return -1;
+	for (jint ordinal = 0; ordinal < m_Count; ++ordinal)
+		if (m_Constants[ordinal] && jni::IsSameObject(value, m_Constants[ordinal]))
+			return ordinal;
+	return -1;
+}
+
+jobject EnumTable::Constant(jint ordinal)
+{
+	if (ordinal < 0 || ordinal >= m_Count || !Initialize())
+		return 0;
+	return m_Constants[ordinal];
+}
+
+// --------------------------------------------------------------------------------------
+// Struct mirrors
+// --------------------------------------------------------------------------------------
+static Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
+
+MirrorLayout::MirrorLayout(Class& clazz, const MirrorField* fields, jint count, size_t size)
+	: m_Class(clazz), m_Fields(fields), m_Count(count), m_Size(size), m_Layout(0)
+{
+}
+
+MirrorLayout::~MirrorLayout()
+{
+	if (m_Layout)
+		jni::DeleteGlobalRef(m_Layout);
+}
+
+// Resolves the fields in java once; racing threads keep the first layout
+jobject MirrorLayout::GetLayout()
+{
+	jobject layout = __atomic_load_n(&m_Layout, __ATOMIC_ACQUIRE);
+	if (layout)
+		return layout;
+
+	LocalFrame frame;
+	static jmethodID newLayoutID = jni::GetStaticMethodID(s_JNIBridgeClass, "newMirrorLayout", "(Ljava/lang/Class;[Ljava/lang/String;Ljava/lang/String;[II)Ljava/lang/Object;");
+	jobjectArray names = jni::NewObjectArray(m_Count, java::lang::String::__CLASS);
+	jintArray offsets = jni::Op<jint>::NewArray(m_Count);
+	char* types = static_cast<char*>(malloc(m_Count + 1));
+	jint* offsetValues = static_cast<jint*>(malloc(m_Count * sizeof(jint) + 1));
+	for (jint i = 0; names && i < m_Count; ++i)
+	{
+		jni::SetObjectArrayElement(names, i, jni::NewStringUTF(m_Fields[i].name));
+		types[i] = m_Fields[i].type;
+		offsetValues[i] = static_cast<jint>(m_Fields[i].offset);
+	}
+	types[m_Count] = 0;
+	jni::Op<jint>::SetArrayRegion(offsets, 0, m_Count, offsetValues);
+	jobject created = jni::PeekError() ? 0 : jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, newLayoutID,
+		static_cast<jclass>(m_Class), names, jni::NewStringUTF(types), offsets, static_cast<jint>(m_Size));
+	free(types);
+	free(offsetValues);
+	if (!created)
+		return 0;
+
+	layout = jni::NewGlobalRef(created);
+	jobject expected = 0;
+	if (!__atomic_compare_exchange_n(&m_Layout, &expected, layout, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		jni::DeleteGlobalRef(layout);
+		layout = expected;
+	}
+	return layout;
+}
+
+bool MirrorLayout::Copy(jobject objects, void* mirrors, size_t count, bool writeBack)
+{
+	if (jni::CheckForParameterError(objects && mirrors))
+		return false;
+	jobject layout = GetLayout();
+	if (!layout)
+		return false;
+	if (!count)
+		return true;
+
+	LocalFrame frame;
+	static jmethodID copyID = jni::GetStaticMethodID(s_JNIBridgeClass, "copyMirrors", "(Ljava/lang/Object;Ljava/lang/Object;Ljava/nio/ByteBuffer;Z)V");
+	jobject buffer = jni::NewDirectByteBuffer(mirrors, m_Size * count);
+	if (buffer)
+		jni::Op<jvoid>::CallStaticMethod(s_JNIBridgeClass, copyID, layout, objects, buffer, static_cast<jboolean>(writeBack));
+	return !jni::PeekError();
+}
+
+bool MirrorLayout::Snapshot(jobjectArray objects, void* mirrors)
+{
+	return Copy(objects, mirrors, objects ? jni::GetArrayLength(objects) : 0, false);
+}
+
+bool MirrorLayout::WriteBack(jobjectArray objects, const void* mirrors)
+{
+	return Copy(objects, const_cast<void*>(mirrors), objects ? jni::GetArrayLength(objects) : 0, true);
+}
 
+// --------------------------------------------------------------------------------------
+// Iteration
+// --------------------------------------------------------------------------------------
+static Class s_IterableClass("java/lang/Iterable");
+
+ObjectIteratorBase::ObjectIteratorBase(jobject source, jint batchSize)
+	: m_Source(0), m_Batch(0), m_Size(batchSize > 0 ? batchSize : 1), m_Count(0), m_Index(0), m_Current(0), m_Frame(0)
+{
+	if (!source)
+		return;
+	{
+		// must be popped before Fetch pushes the first batch frame
+		LocalFrame frame;
+		static jmethodID iteratorID = jni::GetMethodID(s_IterableClass, "iterator", "()Ljava/util/Iterator;");
+		jobject iterator = jni::IsInstanceOf(source, s_IterableClass) ? jni::Op<jobject>::CallMethod(source, iteratorID) : source;
+		jobjectArray batch = jni::NewObjectArray(m_Size, java::lang::Object::__CLASS);
+		if (!iterator || !batch)
+			return;
+		m_Source = jni::NewGlobalRef(iterator);
+		m_Batch = static_cast<jobjectArray>(jni::NewGlobalRef(batch));
+	}
+	Fetch();
+}
+
+ObjectIteratorBase::ObjectIteratorBase(ObjectIteratorBase&& o)
+	: m_Source(o.m_Source), m_Batch(o.m_Batch), m_Size(o.m_Size), m_Count(o.m_Count), m_Index(o.m_Index), m_Current(o.m_Current), m_Frame(o.m_Frame)
+{
+	o.m_Source = 0;
+	o.m_Batch = 0;
+	o.m_Frame = 0;
+}
+
+ObjectIteratorBase::~ObjectIteratorBase()
+{
+	Release();
+}
+
+void ObjectIteratorBase::Release()
+{
+	delete m_Frame;
+	m_Frame = 0;
+	if (m_Source)
+		jni::DeleteGlobalRef(m_Source);
+	if (m_Batch)
+		jni::DeleteGlobalRef(m_Batch);
+	m_Source = 0;
+	m_Batch = 0;
+	m_Current = 0;
+}
+
+// A short batch means the source is exhausted; it ends without another call
+void ObjectIteratorBase::Fetch()
+{
+	static jmethodID fetchID = jni::GetStaticMethodID(s_JNIBridgeClass, "fetch", "(Ljava/lang/Object;[Ljava/lang/Object;)I");
+	if (m_Count && m_Count < m_Size)
+	{
+		Release();
+		return;
+	}
+	delete m_Frame;
+	m_Frame = new LocalFrame(m_Size + 16);
+	m_Count = jni::Op<jint>::CallStaticMethod(s_JNIBridgeClass, fetchID, m_Source, m_Batch);
+	m_Index = 0;
+	if (m_Count <= 0 || jni::PeekError())
+	{
+		Release();
+		return;
+	}
+	m_Current = jni::GetObjectArrayElement(m_Batch, 0);
+}
+
+void ObjectIteratorBase::Advance()
+{
+	if (!m_Source)
+		return;
+	if (++m_Index < m_Count)
+		m_Current = jni::GetObjectArrayElement(m_Batch, m_Index);
+	else
+		Fetch();
+}
+
+// --------------------------------------------------------------------------------------
+// Boxing
+// --------------------------------------------------------------------------------------
+static jobject s_BooleanCache[2];
+static jobject s_ByteCache[256];
+static jobject s_CharacterCache[256];
+static jobject s_ShortCache[256];
+static jobject s_IntegerCache[256];
+static jobject s_LongCache[256];
+
+// Keeps global refs to the same instances java hands out from its valueOf caches
+template <typename T>
+static jobject BoxCached(jobject& slot, jclass clazz, jmethodID valueOf, T value)
+{
+	jobject cached = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);
+	if (!cached)
+	{
+		jobject boxed = jni::Op<jobject>::CallStaticMethod(clazz, valueOf, value);
+		if (!boxed)
+			return 0;
+		cached = jni::NewGlobalRef(boxed);
+		jni::DeleteLocalRef(boxed);
+
+		jobject expected = 0;
+		if (cached && !__atomic_compare_exchange_n(&slot, &expected, cached, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			jni::DeleteGlobalRef(cached);
+			cached = expected;
+		}
+	}
+	return cached ? jni::NewLocalRef(cached) : 0;
+}
+
+// -128..127 are cached
+template <typename T>
+static jobject Box(jobject (&cache)[256], jclass clazz, jmethodID valueOf, T value)
+{
+	jlong index = static_cast<jlong>(value) + 128;
+	if (index < 0 || index > 255)
+		return jni::Op<jobject>::CallStaticMethod(clazz, valueOf, value);
+	return BoxCached(cache[index], clazz, valueOf, value);
+}
+
+jobject Box(jboolean value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Boolean::__CLASS, "valueOf", "(Z)Ljava/lang/Boolean;");
+	return BoxCached(s_BooleanCache[value ? 1 : 0], java::lang::Boolean::__CLASS, valueOf, static_cast<jboolean>(value ? JNI_TRUE : JNI_FALSE));
+}
+
+jobject Box(jbyte value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Byte::__CLASS, "valueOf", "(B)Ljava/lang/Byte;");
+	return Box(s_ByteCache, java::lang::Byte::__CLASS, valueOf, value);
+}
 
+jobject Box(jchar value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Character::__CLASS, "valueOf", "(C)Ljava/lang/Character;");
+	return Box(s_CharacterCache, java::lang::Character::__CLASS, valueOf, value);
+}
+
+jobject Box(jshort value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Short::__CLASS, "valueOf", "(S)Ljava/lang/Short;");
+	return Box(s_ShortCache, java::lang::Short::__CLASS, valueOf, value);
+}
+
+jobject Box(jint value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Integer::__CLASS, "valueOf", "(I)Ljava/lang/Integer;");
+	return Box(s_IntegerCache, java::lang::Integer::__CLASS, valueOf, value);
+}
+
+jobject Box(jlong value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Long::__CLASS, "valueOf", "(J)Ljava/lang/Long;");
+	return Box(s_LongCache, java::lang::Long::__CLASS, valueOf, value);
+}
+
+jobject Box(jfloat value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Float::__CLASS, "valueOf", "(F)Ljava/lang/Float;");
+	return jni::Op<jobject>::CallStaticMethod(java::lang::Float::__CLASS, valueOf, value);
+}
+
+jobject Box(jdouble value)
+{
+	static jmethodID valueOf = jni::GetStaticMethodID(java::lang::Double::__CLASS, "valueOf", "(D)Ljava/lang/Double;");
+	return jni::Op<jobject>::CallStaticMethod(java::lang::Double::__CLASS, valueOf, value);
+}
+
+// --------------------------------------------------------------------------------------
+// Reflection cache
+// --------------------------------------------------------------------------------------
+struct ReflectedMember
+{
+	const void*      id;
+	jclass           clazz;  // global ref; field IDs of unrelated classes can be equal (offsets)
+	bool             field;
+	jobject          member; // global ref
+	ReflectedMember* next;
+};
+
+enum { kReflectedBuckets = 64 }; // power of two
+
+static ReflectedMember* s_ReflectedMembers[kReflectedBuckets];
+static pthread_mutex_t  s_ReflectedLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline ReflectedMember*& ReflectedBucket(const void* id)
+{
+	return s_ReflectedMembers[(reinterpret_cast<uintptr_t>(id) >> 3) & (kReflectedBuckets - 1)];
+}
+
+static jobject LookupReflected(jclass clazz, const void* id, bool field)
+{
+	jobject result = 0;
+	pthread_mutex_lock(&s_ReflectedLock);
+	for (ReflectedMember* entry = ReflectedBucket(id); entry && !result; entry = entry->next)
+	{
+		if (entry->id == id && entry->field == field && jni::IsSameObject(entry->clazz, clazz))
+			result = entry->member;
+	}
+	pthread_mutex_unlock(&s_ReflectedLock);
+	return result;
+}
+
+// racing threads may both add an entry; lookups find either
+static jobject AddReflected(jclass clazz, const void* id, bool field, jobject member)
+{
+	if (!member)
+		return 0;
+	ReflectedMember* entry = static_cast<ReflectedMember*>(malloc(sizeof(ReflectedMember)));
+	entry->id = id;
+	entry->clazz = static_cast<jclass>(jni::NewGlobalRef(clazz));
+	entry->field = field;
+	entry->member = jni::NewGlobalRef(member);
+	jni::DeleteLocalRef(member);
+	pthread_mutex_lock(&s_ReflectedLock);
+	entry->next = ReflectedBucket(id);
+	ReflectedBucket(id) = entry;
+	pthread_mutex_unlock(&s_ReflectedLock);
+	return entry->member;
+}
+
+jobject ReflectMethod(jclass clazz, jmethodID methodID, bool isStatic)
+{
+	if (jni::CheckForParameterError(clazz && methodID))
+		return 0;
+	jobject result = LookupReflected(clazz, methodID, false);
+	return result ? result : AddReflected(clazz, methodID, false, jni::ToReflectedMethod(clazz, methodID, isStatic));
+}
+
+jobject ReflectField(jclass clazz, jfieldID fieldID, bool isStatic)
+{
+	if (jni::CheckForParameterError(clazz && fieldID))
+		return 0;
+	jobject result = LookupReflected(clazz, fieldID, true);
+	return result ? result : AddReflected(clazz, fieldID, true, jni::ToReflectedField(clazz, fieldID, isStatic));
+}
 
 }
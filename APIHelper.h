@@ -1,6 +1,9 @@
 #pragma once
 
 #include "JNIBridge.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
 
 namespace jni
 {
@@ -28,6 +31,7 @@ public:
 	~Ref() { Release(); }
 
 	inline operator ObjType() const	{ return *m_Ref; }
+	inline bool InstanceOf(jclass clazz) const { return m_Ref->InstanceOf(clazz); }
 	Ref<RefType,ObjType>& operator = (const Ref<RefType,ObjType>& o)
 	{
 		if (m_Ref == o.m_Ref)
@@ -47,6 +51,7 @@ private:
 		{
 			m_Object = static_cast<ObjType>(object ? RefType::Alloc(object) : 0);
 			m_Counter = 1;			
+			m_InstanceOf[0] = m_InstanceOf[1] = 0;
 		}
 		~RefCounter()
 		{
@@ -59,9 +64,26 @@ private:
 		void Aquire() { __sync_add_and_fetch(&m_Counter, 1); }
 		bool Release() { return __sync_sub_and_fetch(&m_Counter, 1); }
 
+		// IsInstanceOf memo shared by all copies; class refs are aligned so bit 0 holds the result
+		bool InstanceOf(jclass clazz)
+		{
+			if (!m_Object || !clazz)
+				return false;
+			uintptr_t key = reinterpret_cast<uintptr_t>(clazz);
+			volatile uintptr_t& entry = m_InstanceOf[(key >> 4) & 1];
+			uintptr_t cached = __atomic_load_n(&entry, __ATOMIC_RELAXED);
+			if ((cached & ~uintptr_t(1)) == key)
+				return cached & 1;
+			bool result = jni::IsInstanceOf(m_Object, clazz);
+			if (!jni::PeekError())
+				__atomic_store_n(&entry, key | (result ? 1 : 0), __ATOMIC_RELAXED);
+			return result;
+		}
+
 	private:
 		ObjType      m_Object;
 		volatile int m_Counter;
+		volatile uintptr_t m_InstanceOf[2];
 	};
 
 	void Aquire(RefCounter* ref)
@@ -107,27 +129,341 @@ private:
 	Ref<GlobalRefAllocator, jclass> m_Class;
 };
 
+// ------------------------------------------------
+// Static type hierarchy
+// Generated classes list their generated super types in __SUPERTYPES.
+// __EXACT is false if part of the hierarchy is unknown (opaque or not generated).
+// ------------------------------------------------
+template <typename... Types> struct TypeList {};
+
+template <typename T, typename List> struct Contains;
+template <typename T> struct Contains<T, TypeList<> > { static constexpr bool value = false; };
+template <typename T, typename Head, typename... Tail> struct Contains<T, TypeList<Head, Tail...> >
+{
+	static constexpr bool value = std::is_same<T, Head>::value || Contains<T, TypeList<Tail...> >::value;
+};
+
+template <typename From, typename To> struct IsSubtype
+{
+	static constexpr bool value = std::is_same<From, To>::value || Contains<To, typename From::__SUPERTYPES>::value;
+};
+
+// No object can be both; unrelated classes, or a final class and an interface it doesn't implement
+template <typename A, typename B> struct IsDisjoint
+{
+	static constexpr bool value = A::__EXACT && B::__EXACT && !IsSubtype<A, B>::value && !IsSubtype<B, A>::value
+		&& ((!A::__INTERFACE && !B::__INTERFACE) || A::__FINAL || B::__FINAL);
+};
+
 class Object
 {
 public:
+	typedef TypeList<> __SUPERTYPES;
+	static constexpr bool __INTERFACE = false, __FINAL = false, __EXACT = false;
+
 	explicit inline Object(jobject obj) : m_Object(obj) { }
 
 	inline operator bool() const	{ return m_Object != 0; }
 	inline operator jobject() const	{ return m_Object; }
+	inline bool __InstanceOf(jclass clazz) const { return m_Object.InstanceOf(clazz); }
 
 protected:
 	Ref<GlobalRefAllocator, jobject> m_Object;
 };
 
 
+// ------------------------------------------------
+// Shared call stubs
+// Generated methods only own a constant initialized slot; lookup, attach and
+// error handling live in one out-of-line stub per return kind.
+// Hot members (see APIGenerator --hot/--profile) are inlined and only use
+// the slot to skip the lookup once resolved.
+// ------------------------------------------------
+struct MethodSlot
+{
+	const char* name;
+	const char* signature;
+	jmethodID   id;
+
+	inline jmethodID Get(Class& clazz)       { jmethodID m = __atomic_load_n(&id, __ATOMIC_RELAXED); return m ? m : Resolve(clazz, false); }
+	inline jmethodID GetStatic(Class& clazz) { jmethodID m = __atomic_load_n(&id, __ATOMIC_RELAXED); return m ? m : Resolve(clazz, true); }
+	jmethodID Resolve(Class& clazz, bool isStatic);
+};
+
+struct FieldSlot
+{
+	const char* name;
+	const char* signature;
+	jfieldID    id;
+
+	inline jfieldID Get(Class& clazz)       { jfieldID f = __atomic_load_n(&id, __ATOMIC_RELAXED); return f ? f : Resolve(clazz, false); }
+	inline jfieldID GetStatic(Class& clazz) { jfieldID f = __atomic_load_n(&id, __ATOMIC_RELAXED); return f ? f : Resolve(clazz, true); }
+	jfieldID Resolve(Class& clazz, bool isStatic);
+};
+
+template <typename JT>
+class Call
+{
+public:
+	static JT Method(Class& clazz, MethodSlot* slot, jobject object, ...);
+	static JT StaticMethod(Class& clazz, MethodSlot* slot, ...);
+};
+
+// ------------------------------------------------
+// Memoization
+// Results of members listed in APIGenerator --memoize. A result is kept until
+// its ttl (ms, 0 = no expiry) runs out, InvalidateMemos() is called (also
+// bitter.jnibridge.JNIBridge.invalidateMemos()) or the member is called on
+// another object. Results of calls that raised an error are never kept.
+// ------------------------------------------------
+void InvalidateMemos();
+
+class MemoBase
+{
+protected:
+	explicit MemoBase(jlong ttl);
+	~MemoBase();
+
+	static int Generation();
+
+	// call with the lock held
+	bool IsValid(jobject receiver);
+	void Validate(jobject receiver, int generation);
+
+	void Lock();
+	void Unlock() { __sync_lock_release(&m_Lock); }
+
+private:
+	jlong        m_Ttl;
+	jlong        m_Expires;
+	int          m_Generation;
+	jobject      m_Receiver;
+	volatile int m_Lock;
+};
+
+template <typename T>
+class Memo : MemoBase
+{
+public:
+	explicit Memo(jlong ttl) : MemoBase(ttl), m_Value(0) {}
+	~Memo() { delete m_Value; }
+
+	template <typename Fetch>
+	T Get(jobject receiver, Fetch fetch)
+	{
+		Lock();
+		if (m_Value && IsValid(receiver))
+		{
+			T value(*m_Value);
+			Unlock();
+			return value;
+		}
+		Unlock();
+
+		// never call java with the lock held; an invalidation during the call wins
+		int generation = Generation();
+		T value(fetch());
+		if (jni::PeekError())
+			return value;
+		T* update = new T(value);
+		Lock();
+		T* old = m_Value;
+		m_Value = update;
+		Validate(receiver, generation);
+		Unlock();
+		delete old;
+		return value;
+	}
+
+private:
+	T* m_Value;
+};
+
 // ------------------------------------------------
 // Utillities
 // ------------------------------------------------
 template <typename T> inline bool InstanceOf(jobject o) { return jni::IsInstanceOf(o, T::__CLASS); }
 template <typename T> inline T Cast(jobject o) { return T(InstanceOf<T>(o) ? o : 0); }
+
+// Upcasts are resolved at compile time, impossible casts don't compile and
+// the remaining checks are remembered per referenced object.
+template <typename T, typename S>
+inline typename std::enable_if<std::is_base_of<Object, S>::value, bool>::type InstanceOf(const S& o)
+{
+	static_assert(!IsDisjoint<S, T>::value, "jni::InstanceOf: no object is an instance of both types");
+	if (IsSubtype<S, T>::value)
+		return o;
+	return o.__InstanceOf(T::__CLASS);
+}
+template <typename T, typename S>
+inline typename std::enable_if<std::is_base_of<Object, S>::value, T>::type Cast(const S& o)
+{
+	return T(InstanceOf<T>(o) ? static_cast<jobject>(o) : 0);
+}
 template <typename T> inline bool Catch() { return jni::ExceptionThrown(T::__CLASS); }
 template <typename T> inline bool ThrowNew(const char* message) { return jni::ThrowNew(T::__CLASS, message) == 0; }
 
+// ------------------------------------------------
+// Boxing
+// Returns a local ref; Boolean.TRUE/FALSE and values in the valueOf cache range are shared instances
+// ------------------------------------------------
+jobject Box(jboolean value);
+jobject Box(jbyte value);
+jobject Box(jchar value);
+jobject Box(jshort value);
+jobject Box(jint value);
+jobject Box(jlong value);
+jobject Box(jfloat value);
+jobject Box(jdouble value);
+
+// ------------------------------------------------
+// Reflection cache
+// java.lang.reflect.Method / Field global refs per (class, member ID), kept for the
+// lifetime of the process. IDs alone aren't unique: instance field IDs are offsets
+// on some VMs. Subclasses reflecting an inherited member get entries of their own.
+// ------------------------------------------------
+jobject ReflectMethod(jclass clazz, jmethodID methodID, bool isStatic);
+jobject ReflectField(jclass clazz, jfieldID fieldID, bool isStatic);
+
+// ------------------------------------------------
+// Enum Support
+// Maps the constants of a java enum to the ordinals of its generated 'enum class'.
+// Constants are matched by name, so a runtime that added constants still maps correctly.
+// ------------------------------------------------
+class EnumTable
+{
+public:
+	EnumTable(Class& clazz, const char* valuesSignature, const char* const* names, jint count);
+	~EnumTable();
+
+	jint    Ordinal(jobject value); // -1 if 'value' is null or unknown
+	jobject Constant(jint ordinal); // global ref, 0 if the runtime doesn't have the constant
+
+private:
+	bool Initialize();
+
+private:
+	EnumTable(const EnumTable& table);
+	EnumTable& operator = (const EnumTable& o);
+
+private:
+	Class&             m_Class;
+	const char*        m_ValuesSignature;
+	const char* const* m_Names;
+	jint               m_Count;
+	jobject*           m_Constants;
+	volatile int       m_State;
+};
+
+// ------------------------------------------------
+// Struct mirrors
+// Primitive instance fields of classes listed in APIGenerator --mirror, copied to or
+// from the generated __Mirror struct(s) with one call into bitter.jnibridge.JNIBridge.
+// Java writes the struct layout directly, using the offsets the struct was compiled with.
+// ------------------------------------------------
+struct MirrorField
+{
+	const char* name;
+	char        type;   // JNI signature, e.g. 'F'
+	size_t      offset;
+};
+
+class MirrorLayout
+{
+public:
+	MirrorLayout(Class& clazz, const MirrorField* fields, jint count, size_t size);
+	~MirrorLayout();
+
+	bool Snapshot(jobject object, void* mirror)        { return Copy(object, mirror, 1, false); }
+	bool WriteBack(jobject object, const void* mirror) { return Copy(object, const_cast<void*>(mirror), 1, true); }
+	// One mirror per array element; null elements are skipped. Final fields aren't written back.
+	bool Snapshot(jobjectArray objects, void* mirrors);
+	bool WriteBack(jobjectArray objects, const void* mirrors);
+
+private:
+	jobject GetLayout();
+	bool    Copy(jobject objects, void* mirrors, size_t count, bool writeBack);
+
+private:
+	MirrorLayout(const MirrorLayout& layout);
+	MirrorLayout& operator = (const MirrorLayout& o);
+
+private:
+	Class&             m_Class;
+	const MirrorField* m_Fields;
+	jint               m_Count;
+	size_t             m_Size;
+	jobject            m_Layout; // bitter.jnibridge.JNIBridge$MirrorLayout, global ref
+};
+
+// ------------------------------------------------
+// Iteration
+// Range-for over a java.lang.Iterable, java.util.Iterator or java.util.Enumeration.
+// Elements are fetched in batches with one call into bitter.jnibridge.JNIBridge.fetch.
+// Each batch runs in its own LocalFrame: local refs made in the loop body only live
+// until the next batch (wrap them, or NewGlobalRef, to keep them longer).
+// ------------------------------------------------
+class ObjectIteratorBase
+{
+public:
+	// Only meaningful against end()
+	inline bool operator != (const ObjectIteratorBase& o) const { return m_Source != o.m_Source; }
+
+protected:
+	ObjectIteratorBase() : m_Source(0), m_Batch(0), m_Size(0), m_Count(0), m_Index(0), m_Current(0), m_Frame(0) {}
+	ObjectIteratorBase(jobject source, jint batchSize);
+	ObjectIteratorBase(ObjectIteratorBase&& o);
+	~ObjectIteratorBase();
+
+	void Advance();
+
+private:
+	ObjectIteratorBase(const ObjectIteratorBase& o);
+	ObjectIteratorBase& operator = (const ObjectIteratorBase& o);
+
+	void Fetch();
+	void Release();
+
+protected:
+	jobject      m_Source;  // java.util.Iterator or Enumeration, global ref; 0 at the end
+	jobjectArray m_Batch;   // global ref
+	jint         m_Size;
+	jint         m_Count;
+	jint         m_Index;
+	jobject      m_Current; // local ref in m_Frame
+	LocalFrame*  m_Frame;
+};
+
+template <typename T = jobject>
+class ObjectIterator : public ObjectIteratorBase
+{
+public:
+	ObjectIterator() {}
+	explicit ObjectIterator(jobject source, jint batchSize = 64) : ObjectIteratorBase(source, batchSize) {}
+	ObjectIterator(ObjectIterator&& o) : ObjectIteratorBase(static_cast<ObjectIteratorBase&&>(o)) {}
+
+	inline T operator * () const { return T(m_Current); }
+	inline ObjectIterator& operator ++ () { Advance(); return *this; }
+};
+
+// e.g. for (::java::lang::String name : jni::Iterate< ::java::lang::String >(names))
+template <typename T = jobject>
+struct ObjectRange
+{
+	jobject source;
+	jint    batchSize;
+
+	inline ObjectIterator<T> begin() const { return ObjectIterator<T>(source, batchSize); }
+	inline ObjectIterator<T> end() const   { return ObjectIterator<T>(); }
+};
+
+template <typename T>
+inline ObjectRange<T> Iterate(jobject source, jint batchSize = 64)
+{
+	ObjectRange<T> range = { source, batchSize };
+	return range;
+}
+
 // ------------------------------------------------	
 // Array Support
 // ------------------------------------------------
@@ -280,22 +616,100 @@ DEF_PRIMITIVE_ARRAY_TYPE(jchar)
 // ------------------------------------------------
 // Proxy Support
 // ------------------------------------------------
+enum ProxyDispatch
+{
+	kProxyDispatchSync = 0,     // void callbacks run on the invoking java thread
+	kProxyDispatchAsync,        // void callbacks are queued and run on any worker
+	kProxyDispatchAsyncOrdered  // void callbacks are queued and run in order per proxy
+};
+
+class ProxyInvoker;
+
+class ProxyCall
+{
+public:
+	ProxyCall() : m_Proxy(0), m_Next(0) {}
+	virtual ~ProxyCall() {}
+	virtual void Invoke() = 0;
+
+public:
+	ProxyInvoker*        m_Proxy;
+	ProxyCall* volatile  m_Next;
+
+private:
+	ProxyCall(const ProxyCall& call);
+	ProxyCall& operator = (const ProxyCall& o);
+};
+
+template <typename F>
+class ProxyFunctionCall : public ProxyCall
+{
+public:
+	explicit ProxyFunctionCall(const F& function) : m_Function(function) {}
+	virtual void Invoke() { m_Function(); }
+
+private:
+	F m_Function;
+};
+
+// Native worker pool draining queued (async) proxy callbacks
+class ProxyDispatcher
+{
+public:
+	struct Stats
+	{
+		unsigned workers;
+		unsigned depth;     // callbacks queued but not yet executed
+		unsigned maxDepth;  // high-water mark of depth
+		unsigned posted;
+		unsigned executed;
+	};
+
+	static bool Start(unsigned workers = 1);
+	static void Stop();
+	// Waits for the callbacks queued so far; returns at once on a worker thread
+	static void Flush();
+	static void GetStats(Stats* stats);
+
+private:
+	friend class ProxyInvoker;
+	static void  Post(ProxyCall* call, bool ordered);
+	static void* Run(void* worker);
+};
+
 class ProxyInvoker
 {
 public:
-	ProxyInvoker() {}
+	ProxyInvoker() : m_Dispatch(kProxyDispatchSync), m_References(1) {}
 	virtual ~ProxyInvoker() {};
 	virtual jobject __Invoke(jclass, jmethodID, jobjectArray) = 0;
 
 public:
 	static bool __Register();
+	static void __Release(ProxyInvoker* proxy);
 
 protected:
 	virtual ::jobject __ProxyObject() const = 0;
 
+	inline bool __Async() const { return m_Dispatch != kProxyDispatchSync; }
+	inline void __SetDispatch(ProxyDispatch dispatch) { m_Dispatch = dispatch; }
+
+	template <typename F>
+	inline void __Post(const F& function) { __Enqueue(new ProxyFunctionCall<F>(function)); }
+	void __Enqueue(ProxyCall* call);
+	void __CheckDrained();
+
+private:
+	friend class ProxyDispatcher;
+	void __Complete(ProxyCall* call);
+
 private:
 	ProxyInvoker(const ProxyInvoker& proxy);
 	ProxyInvoker& operator = (const ProxyInvoker& o);
+
+private:
+	ProxyDispatch m_Dispatch;
+	volatile int  m_References;
 };
 
 }
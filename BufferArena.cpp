@@ -0,0 +1,270 @@
+#include "BufferArena.h"
+#include "APIHelper.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace jni
+{
+
+// Serializes reclaiming handed off slices with arena destruction
+static pthread_mutex_t s_ReclaimLock = PTHREAD_MUTEX_INITIALIZER;
+
+static jni::Class s_BufferClass("java/nio/Buffer");
+static jni::Class s_ByteBufferClass("java/nio/ByteBuffer");
+static jni::Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
+
+JNIEXPORT void JNICALL Java_bitter_jnibridge_JNIBridge_releaseBuffer(JNIEnv* env, jclass clazz, jlong ptr)
+{
+	BufferArena::__Reclaim(reinterpret_cast<ArenaBuffer*>(ptr));
+}
+
+bool BufferArena::__Register()
+{
+	jni::LocalFrame frame;
+	char releaseMethodName[] = "releaseBuffer";
+	char releaseMethodSignature[] = "(J)V";
+
+	JNINativeMethod nativeArenaFunction[] = {
+		{releaseMethodName, releaseMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_releaseBuffer}
+	};
+
+	jni::RegisterNatives(s_JNIBridgeClass, nativeArenaFunction, sizeof(nativeArenaFunction) / sizeof(nativeArenaFunction[0]));
+	return !jni::CheckError();
+}
+
+// Without releaseBuffer java's cleaner thread dies and every tracked slice leaks
+static bool EnsureRegistered()
+{
+	static bool registered = BufferArena::__Register();
+	if (!registered)
+		jni::CheckForParameterError(false);
+	return registered;
+}
+
+// --------------------------------------------------------------------------------------
+// ArenaBuffer
+// --------------------------------------------------------------------------------------
+ArenaBuffer::ArenaBuffer(BufferArena* arena, void* data, size_t size)
+: m_Arena(arena)
+, m_Data(data)
+, m_Size(size)
+, m_Buffer(0)
+, m_Uses(0)
+, m_HandedOff(false)
+, m_Next(0)
+, m_Prev(0)
+{
+}
+
+ArenaBuffer::~ArenaBuffer()
+{
+	if (m_Buffer)
+		jni::DeleteGlobalRef(m_Buffer);
+	free(m_Data);
+}
+
+jobject ArenaBuffer::ByteBuffer()
+{
+	if (!m_Buffer)
+	{
+		jni::LocalFrame frame;
+		m_Buffer = jni::NewGlobalRef(jni::NewDirectByteBuffer(m_Data, m_Size));
+	}
+	return m_Buffer;
+}
+
+// java tracks every view, each one holds a use of the slice until it's collected
+jobject ArenaBuffer::Slice(size_t offset, size_t length)
+{
+	if (jni::CheckForParameterError(offset <= m_Size && length <= m_Size - offset))
+		return 0;
+	static jmethodID sliceID = jni::GetStaticMethodID(s_JNIBridgeClass, "sliceBuffer", "(Ljava/nio/ByteBuffer;IIJ)Ljava/nio/ByteBuffer;");
+	jobject buffer = ByteBuffer();
+	if (!buffer || !EnsureRegistered())
+		return 0;
+	__sync_add_and_fetch(&m_Uses, 1);
+	jobject view = jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, sliceID, buffer, static_cast<jint>(offset), static_cast<jint>(length), reinterpret_cast<jlong>(this));
+	if (!view)
+		__sync_sub_and_fetch(&m_Uses, 1);
+	return view;
+}
+
+jobject ArenaBuffer::Duplicate()
+{
+	static jmethodID duplicateID = jni::GetStaticMethodID(s_JNIBridgeClass, "duplicateBuffer", "(Ljava/nio/ByteBuffer;J)Ljava/nio/ByteBuffer;");
+	jobject buffer = ByteBuffer();
+	if (!buffer || !EnsureRegistered())
+		return 0;
+	__sync_add_and_fetch(&m_Uses, 1);
+	jobject view = jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, duplicateID, buffer, reinterpret_cast<jlong>(this));
+	if (!view)
+		__sync_sub_and_fetch(&m_Uses, 1);
+	return view;
+}
+
+// --------------------------------------------------------------------------------------
+// BufferArena
+// --------------------------------------------------------------------------------------
+BufferArena::BufferArena(size_t sliceSize, size_t alignment, size_t maxSlices)
+: m_SliceSize(sliceSize)
+, m_Alignment(alignment < sizeof(void*) ? sizeof(void*) : alignment)
+, m_MaxSlices(maxSlices)
+, m_Slices(0)
+, m_Free(0)
+, m_HandedOff(0)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	pthread_mutex_init(&m_Lock, NULL);
+}
+
+BufferArena::~BufferArena()
+{
+	pthread_mutex_lock(&s_ReclaimLock);
+	pthread_mutex_lock(&m_Lock);
+	for (ArenaBuffer* buffer = m_HandedOff; buffer; buffer = buffer->m_Next)
+		buffer->m_Arena = 0;
+	m_HandedOff = 0;
+	// slices with live views are freed by the last one's __Reclaim
+	while (ArenaBuffer* buffer = m_Free)
+	{
+		m_Free = buffer->m_Next;
+		if (buffer->m_Uses)
+			buffer->m_Arena = 0;
+		else
+			delete buffer;
+	}
+	pthread_mutex_unlock(&m_Lock);
+	pthread_mutex_unlock(&s_ReclaimLock);
+	pthread_mutex_destroy(&m_Lock);
+}
+
+ArenaBuffer* BufferArena::Acquire()
+{
+	pthread_mutex_lock(&m_Lock);
+	ArenaBuffer* buffer = m_Free;
+	if (buffer)
+	{
+		m_Free = buffer->m_Next;
+		++m_Stats.reuses;
+	}
+	else if (!m_MaxSlices || m_Slices < m_MaxSlices)
+	{
+		void* data = 0;
+		if (posix_memalign(&data, m_Alignment, m_SliceSize) == 0)
+		{
+			buffer = new ArenaBuffer(this, data, m_SliceSize);
+			++m_Slices;
+			m_Stats.capacity += m_SliceSize;
+		}
+	}
+	if (buffer)
+	{
+		buffer->m_Next = 0;
+		++m_Stats.acquires;
+		m_Stats.inUse += m_SliceSize;
+		if (m_Stats.inUse > m_Stats.highWater)
+			m_Stats.highWater = m_Stats.inUse;
+	}
+	pthread_mutex_unlock(&m_Lock);
+
+	// java may have moved position/limit of a recycled buffer
+	if (buffer && buffer->m_Buffer)
+	{
+		static jmethodID clearID = jni::GetMethodID(s_BufferClass, "clear", "()Ljava/nio/Buffer;");
+		jni::DeleteLocalRef(jni::Op<jobject>::CallMethod(buffer->m_Buffer, clearID));
+	}
+	return buffer;
+}
+
+void BufferArena::Release(ArenaBuffer* buffer)
+{
+	if (!buffer)
+		return;
+	pthread_mutex_lock(&m_Lock);
+	buffer->m_Next = m_Free;
+	m_Free = buffer;
+	m_Stats.inUse -= m_SliceSize;
+	pthread_mutex_unlock(&m_Lock);
+}
+
+jobject BufferArena::HandOff(ArenaBuffer* buffer)
+{
+	if (!buffer)
+		return 0;
+	if (!EnsureRegistered())
+	{
+		Release(buffer);
+		return 0;
+	}
+	jobject result = jni::NewLocalRef(buffer->ByteBuffer());
+	if (!result)
+	{
+		Release(buffer);
+		return 0;
+	}
+
+	// the arena must not keep the buffer reachable, java reports when it's gone
+	jni::DeleteGlobalRef(buffer->m_Buffer);
+	buffer->m_Buffer = 0;
+
+	__sync_add_and_fetch(&buffer->m_Uses, 1);
+	pthread_mutex_lock(&m_Lock);
+	buffer->m_HandedOff = true;
+	buffer->m_Prev = 0;
+	buffer->m_Next = m_HandedOff;
+	if (m_HandedOff)
+		m_HandedOff->m_Prev = buffer;
+	m_HandedOff = buffer;
+	++m_Stats.handOffs;
+	pthread_mutex_unlock(&m_Lock);
+
+	static jmethodID handOffID = jni::GetStaticMethodID(s_JNIBridgeClass, "handOffBuffer", "(Ljava/lang/Object;J)V");
+	jni::Op<jvoid>::CallStaticMethod(s_JNIBridgeClass, handOffID, result, reinterpret_cast<jlong>(buffer));
+	return result;
+}
+
+// Called once per collected tracked object (the handed off buffer or a view). The slice
+// is recycled when none is left and it was handed off; views of a slice that's still
+// acquired only drop their use.
+void BufferArena::__Reclaim(ArenaBuffer* buffer)
+{
+	pthread_mutex_lock(&s_ReclaimLock);
+	BufferArena* arena = buffer->m_Arena;
+	bool unused = __sync_sub_and_fetch(&buffer->m_Uses, 1) == 0;
+	if (!arena)
+	{
+		pthread_mutex_unlock(&s_ReclaimLock);
+		if (unused)
+			delete buffer;
+		return;
+	}
+
+	pthread_mutex_lock(&arena->m_Lock);
+	if (unused && buffer->m_HandedOff)
+	{
+		if (buffer->m_Prev)
+			buffer->m_Prev->m_Next = buffer->m_Next;
+		else
+			arena->m_HandedOff = buffer->m_Next;
+		if (buffer->m_Next)
+			buffer->m_Next->m_Prev = buffer->m_Prev;
+		buffer->m_HandedOff = false;
+		buffer->m_Prev = 0;
+		buffer->m_Next = arena->m_Free;
+		arena->m_Free = buffer;
+		arena->m_Stats.inUse -= arena->m_SliceSize;
+	}
+	pthread_mutex_unlock(&arena->m_Lock);
+	pthread_mutex_unlock(&s_ReclaimLock);
+}
+
+BufferArena::Stats BufferArena::GetStats()
+{
+	pthread_mutex_lock(&m_Lock);
+	Stats stats = m_Stats;
+	pthread_mutex_unlock(&m_Lock);
+	return stats;
+}
+
+}
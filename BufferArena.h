@@ -0,0 +1,92 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+#include <pthread.h>
+
+namespace jni
+{
+
+class BufferArena;
+
+// An aligned slice of native memory and the direct ByteBuffer that wraps it.
+// The ByteBuffer is created once and recycled with the slice.
+class ArenaBuffer
+{
+public:
+	inline void*  Data() const { return m_Data; }
+	inline size_t Size() const { return m_Size; }
+
+	// Global ref owned by the buffer; cleared (position 0, limit = capacity) on every Acquire
+	jobject ByteBuffer();
+
+	// Views (local refs) of ByteBuffer() sharing the slice's memory. java tracks each
+	// one, so a handed off slice isn't recycled while a view lives. Before a hand off
+	// they are only valid until Release, like ByteBuffer().
+	jobject Slice(size_t offset, size_t length);
+	jobject Duplicate();
+
+private:
+	friend class BufferArena;
+	ArenaBuffer(BufferArena* arena, void* data, size_t size);
+	~ArenaBuffer();
+
+	BufferArena* m_Arena;     // 0 once the arena is gone
+	void*        m_Data;
+	size_t       m_Size;
+	jobject      m_Buffer;    // global ref, 0 while handed off
+	volatile int m_Uses;      // objects java tracks: the handed off buffer and views
+	bool         m_HandedOff;
+	ArenaBuffer* m_Next;      // free list or hand off list
+	ArenaBuffer* m_Prev;      // hand off list
+};
+
+// Pool of fixed size slices handed out as cached direct ByteBuffers
+class BufferArena
+{
+public:
+	struct Stats
+	{
+		size_t capacity;  // bytes allocated
+		size_t inUse;     // bytes acquired or handed off
+		size_t highWater;
+		size_t acquires;
+		size_t reuses;    // acquires served from the pool
+		size_t handOffs;
+	};
+
+	// maxSlices 0 means unbounded
+	BufferArena(size_t sliceSize, size_t alignment = 64, size_t maxSlices = 0);
+	~BufferArena();
+
+	// 0 if the arena is exhausted or allocation fails
+	ArenaBuffer* Acquire();
+	void         Release(ArenaBuffer* buffer);
+
+	// Moves ownership of the ByteBuffer to java and returns a local ref to it.
+	// The slice comes back to the pool once java has collected the buffer.
+	// Registers the natives on first use; 0 (slice released) if that fails.
+	jobject      HandOff(ArenaBuffer* buffer);
+
+	Stats        GetStats();
+	inline size_t GetSliceSize() const { return m_SliceSize; }
+
+	// Registers bitter.jnibridge.JNIBridge.releaseBuffer; HandOff does it when needed
+	static bool  __Register();
+	static void  __Reclaim(ArenaBuffer* buffer);
+
+private:
+	BufferArena(const BufferArena& arena);
+	BufferArena& operator = (const BufferArena& o);
+
+	size_t          m_SliceSize;
+	size_t          m_Alignment;
+	size_t          m_MaxSlices;
+	size_t          m_Slices;
+	ArenaBuffer*    m_Free;
+	ArenaBuffer*    m_HandedOff;  // orphaned when the arena goes away, java frees them
+	Stats           m_Stats;
+	pthread_mutex_t m_Lock;
+};
+
+}
@@ -0,0 +1,171 @@
+#include "Collections.h"
+#include "APIHelper.h"
+
+namespace jni
+{
+
+static jni::Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
+static jni::Class s_ObjectClass("java/lang/Object");
+
+jobjectArray ToArray(jobject collection)
+{
+	static jmethodID flattenID = jni::GetStaticMethodID(s_JNIBridgeClass, "flatten", "(Ljava/lang/Object;)[Ljava/lang/Object;");
+	if (jni::CheckForParameterError(collection != 0))
+		return 0;
+	return static_cast<jobjectArray>(jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, flattenID, collection));
+}
+
+jarray __ToPrimitives(jobject collection, jarray prototype)
+{
+	static jmethodID toPrimitivesID = jni::GetStaticMethodID(s_JNIBridgeClass, "toPrimitives", "(Ljava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;");
+	if (jni::CheckForParameterError(collection && prototype))
+		return 0;
+	return static_cast<jarray>(jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, toPrimitivesID, collection, prototype));
+}
+
+jobject __NewList(jarray values)
+{
+	static jmethodID newListID = jni::GetStaticMethodID(s_JNIBridgeClass, "newList", "(Ljava/lang/Object;)Ljava/util/List;");
+	return jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, newListID, values);
+}
+
+// --------------------------------------------------------------------------------------
+// Strings cross as one UTF-8 block and a length per string (-1 for null)
+// --------------------------------------------------------------------------------------
+template <typename Emit>
+static bool DecodeStrings(jobject collection, Emit emit)
+{
+	static jmethodID encodeID = jni::GetStaticMethodID(s_JNIBridgeClass, "encodeStrings", "(Ljava/lang/Object;)[Ljava/lang/Object;");
+	if (jni::CheckForParameterError(collection != 0))
+		return false;
+
+	jni::LocalFrame frame;
+	jobjectArray encoded = static_cast<jobjectArray>(jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, encodeID, collection));
+	if (!encoded)
+		return false;
+	jbyteArray data = static_cast<jbyteArray>(jni::GetObjectArrayElement(encoded, 0));
+	jintArray lengths = static_cast<jintArray>(jni::GetObjectArrayElement(encoded, 1));
+	size_t count = lengths ? jni::GetArrayLength(lengths) : 0;
+	std::vector<jint> sizes(count);
+	if (count)
+		jni::Op<jint>::GetArrayRegion(lengths, 0, count, &sizes[0]);
+	if (jni::PeekError())
+		return false;
+
+	// no jni calls while the block is pinned
+	const char* chars = static_cast<const char*>(jni::GetPrimitiveArrayCritical(data, 0));
+	if (!chars)
+		return false;
+	size_t offset = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t size = sizes[i] > 0 ? sizes[i] : 0;
+		emit(i, chars + offset, size);
+		offset += size;
+	}
+	jni::ReleasePrimitiveArrayCritical(data, const_cast<char*>(chars), JNI_ABORT);
+	return true;
+}
+
+struct AppendStrings
+{
+	std::vector<std::string>& strings;
+	void operator () (size_t, const char* chars, size_t size) { strings.push_back(std::string(chars, size)); }
+};
+
+struct InsertStrings
+{
+	std::unordered_map<std::string, std::string>& strings;
+	const char* key;
+	size_t      keySize;
+	void operator () (size_t i, const char* chars, size_t size)
+	{
+		if (i & 1)
+			strings[std::string(key, keySize)].assign(chars, size);
+		else
+		{
+			key = chars;
+			keySize = size;
+		}
+	}
+};
+
+bool ToStrings(jobject collection, std::vector<std::string>& strings)
+{
+	AppendStrings append = { strings };
+	return DecodeStrings(collection, append);
+}
+
+bool ToStringMap(jobject map, std::unordered_map<std::string, std::string>& strings)
+{
+	static jni::Class s_MapClass("java/util/Map");
+	if (jni::CheckForParameterError(map && jni::IsInstanceOf(map, s_MapClass)))
+		return false;
+	InsertStrings insert = { strings, 0, 0 };
+	return DecodeStrings(map, insert);
+}
+
+// 'factory' builds the List or Map from the block and lengths
+static jobject EncodeStrings(jmethodID factory, const std::string** strings, size_t count)
+{
+	size_t total = 0;
+	std::vector<jint> sizes(count);
+	for (size_t i = 0; i < count; ++i)
+		total += sizes[i] = static_cast<jint>(strings[i]->size());
+	std::vector<jbyte> block(total);
+	size_t offset = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		strings[i]->copy(reinterpret_cast<char*>(block.data()) + offset, sizes[i]);
+		offset += sizes[i];
+	}
+
+	jbyteArray data = jni::Op<jbyte>::NewArray(total);
+	jintArray lengths = jni::Op<jint>::NewArray(count);
+	if (total)
+		jni::Op<jbyte>::SetArrayRegion(data, 0, total, block.data());
+	if (count)
+		jni::Op<jint>::SetArrayRegion(lengths, 0, count, sizes.data());
+	jobject result = jni::PeekError() ? 0 : jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, factory, data, lengths);
+	if (data)
+		jni::DeleteLocalRef(data);
+	if (lengths)
+		jni::DeleteLocalRef(lengths);
+	return result;
+}
+
+jobject NewList(const std::vector<std::string>& strings)
+{
+	static jmethodID newStringListID = jni::GetStaticMethodID(s_JNIBridgeClass, "newStringList", "([B[I)Ljava/util/List;");
+	std::vector<const std::string*> pointers(strings.size());
+	for (size_t i = 0; i < strings.size(); ++i)
+		pointers[i] = &strings[i];
+	return EncodeStrings(newStringListID, pointers.data(), pointers.size());
+}
+
+jobject NewMap(const std::unordered_map<std::string, std::string>& strings)
+{
+	static jmethodID newStringMapID = jni::GetStaticMethodID(s_JNIBridgeClass, "newStringMap", "([B[I)Ljava/util/Map;");
+	std::vector<const std::string*> pointers;
+	pointers.reserve(strings.size() * 2);
+	for (std::unordered_map<std::string, std::string>::const_iterator it = strings.begin(); it != strings.end(); ++it)
+	{
+		pointers.push_back(&it->first);
+		pointers.push_back(&it->second);
+	}
+	return EncodeStrings(newStringMapID, pointers.data(), pointers.size());
+}
+
+jobject NewList(const std::vector<jobject>& objects)
+{
+	jobjectArray array = jni::NewObjectArray(objects.size(), s_ObjectClass);
+	if (!array)
+		return 0;
+	for (size_t i = 0; i < objects.size(); ++i)
+		jni::SetObjectArrayElement(array, i, objects[i]);
+	jobject list = __NewList(array);
+	jni::DeleteLocalRef(array);
+	return list;
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace jni
+{
+
+// ------------------------------------------------
+// Bulk conversions between java.util collections and native containers.
+// java flattens a Map (keys and values), Collection, Iterable, Iterator, Enumeration
+// or Object[] into arrays that cross in one call; strings travel as one UTF-8 block.
+// Null strings convert to empty ones. Everything returns false / 0 if java failed
+// (see jni::CheckError).
+// ------------------------------------------------
+
+// Local ref; a Map gives its keys and values alternating
+jobjectArray ToArray(jobject collection);
+
+// Elements (or map keys and values alternating) as strings, appended to 'strings'
+bool ToStrings(jobject collection, std::vector<std::string>& strings);
+// Keys and values (String.valueOf) of a java.util.Map, e.g. Properties; adds to 'map'
+bool ToStringMap(jobject map, std::unordered_map<std::string, std::string>& strings);
+
+// New java.util.ArrayList / HashMap (local refs)
+jobject NewList(const std::vector<jobject>& objects);
+jobject NewList(const std::vector<std::string>& strings);
+jobject NewMap(const std::unordered_map<std::string, std::string>& strings);
+
+jarray  __ToPrimitives(jobject collection, jarray prototype);
+jobject __NewList(jarray values);
+
+// Boxed elements, unboxed and widened to T by java; appended to 'values'
+template <typename T>
+bool ToVector(jobject collection, std::vector<T>& values)
+{
+	typedef decltype(jni::Op<T>::NewArray(0)) ArrayType;
+	jni::LocalFrame frame;
+	ArrayType array = static_cast<ArrayType>(__ToPrimitives(collection, jni::Op<T>::NewArray(0)));
+	if (!array)
+		return false;
+	size_t offset = values.size();
+	size_t count = jni::GetArrayLength(array);
+	values.resize(offset + count);
+	if (count)
+		jni::Op<T>::GetArrayRegion(array, 0, count, &values[offset]);
+	return !jni::PeekError();
+}
+
+// New java.util.ArrayList of boxed values (local ref)
+template <typename T>
+jobject NewList(const std::vector<T>& values)
+{
+	typedef decltype(jni::Op<T>::NewArray(0)) ArrayType;
+	ArrayType array = jni::Op<T>::NewArray(values.size());
+	if (!array)
+		return 0;
+	if (!values.empty())
+		jni::Op<T>::SetArrayRegion(array, 0, values.size(), const_cast<T*>(&values[0]));
+	jobject list = __NewList(array);
+	jni::DeleteLocalRef(array);
+	return list;
+}
+
+}
@@ -0,0 +1,148 @@
+#include "CommandBuffer.h"
+#include "APIHelper.h"
+
+#include <stdlib.h>
+
+namespace jni
+{
+
+static jni::Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
+static jni::Class s_ObjectClass("java/lang/Object");
+
+CommandBuffer::CommandBuffer()
+: m_Words(0)
+, m_Tags(0)
+, m_WordCount(0)
+, m_WordCapacity(0)
+, m_Objects(0)
+, m_ObjectCount(0)
+, m_ObjectCapacity(0)
+, m_Strings(0)
+, m_StringCount(0)
+, m_StringCapacity(0)
+, m_Methods(0)
+, m_MethodCount(0)
+, m_MethodCapacity(0)
+, m_Receiver(0)
+, m_ReceiverIndex(-1)
+, m_CommandCount(0)
+{
+}
+
+CommandBuffer::~CommandBuffer()
+{
+	Clear();
+	free(m_Words);
+	free(m_Tags);
+	free(m_Objects);
+	free(m_Strings);
+	free(m_Methods);
+}
+
+void CommandBuffer::Grow(void*& data, size_t& capacity, size_t elementSize)
+{
+	capacity = capacity ? capacity * 2 : 32;
+	data = realloc(data, capacity * elementSize);
+}
+
+jlong CommandBuffer::AddObject(jobject object)
+{
+	if (!object)
+		return -1;
+	if (m_ObjectCount == m_ObjectCapacity)
+		Grow(reinterpret_cast<void*&>(m_Objects), m_ObjectCapacity, sizeof(jobject));
+	m_Objects[m_ObjectCount] = object;
+	return m_ObjectCount++;
+}
+
+bool CommandBuffer::Begin(jobject receiver, jclass clazz, jmethodID methodID, size_t argCount)
+{
+	if (jni::CheckForParameterError((receiver || clazz) && methodID))
+		return false;
+
+	jlong methodIndex = -1;
+	for (size_t i = 0; i < m_MethodCount; ++i)
+	{
+		if (m_Methods[i].id != methodID)
+			continue;
+		methodIndex = m_Methods[i].index;
+		break;
+	}
+	if (methodIndex < 0)
+	{
+		jobject method;
+		{
+			jni::LocalFrame frame;
+			method = jni::ReflectMethod(receiver ? jni::GetObjectClass(receiver) : clazz, methodID, receiver == 0);
+		}
+		if (!method)
+			return false;
+		if (m_MethodCount == m_MethodCapacity)
+			Grow(reinterpret_cast<void*&>(m_Methods), m_MethodCapacity, sizeof(MethodEntry));
+		methodIndex = AddObject(method);
+		m_Methods[m_MethodCount].id = methodID;
+		m_Methods[m_MethodCount++].index = methodIndex;
+	}
+
+	// consecutive calls on one receiver share its slot
+	if (receiver != m_Receiver || !receiver)
+	{
+		m_Receiver = receiver;
+		m_ReceiverIndex = AddObject(receiver);
+	}
+	PushWord(methodIndex, kTagHeader);
+	PushWord(m_ReceiverIndex, kTagHeader);
+	PushWord(argCount, kTagHeader);
+	++m_CommandCount;
+	return true;
+}
+
+void CommandBuffer::Pack(const char* value)
+{
+	if (!value)
+	{
+		PushWord(-1, kTagObject);
+		return;
+	}
+	jni::LocalFrame frame;
+	jobject string = jni::NewGlobalRef(jni::NewStringUTF(value));
+	if (m_StringCount == m_StringCapacity)
+		Grow(reinterpret_cast<void*&>(m_Strings), m_StringCapacity, sizeof(jobject));
+	m_Strings[m_StringCount++] = string;
+	PushWord(AddObject(string), kTagObject);
+}
+
+bool CommandBuffer::Submit()
+{
+	if (!m_CommandCount)
+		return true;
+
+	jni::LocalFrame frame;
+	static jmethodID executeID = jni::GetStaticMethodID(s_JNIBridgeClass, "executeCommands", "([Ljava/lang/Object;[J[B)V");
+	jobjectArray objects = jni::NewObjectArray(m_ObjectCount, s_ObjectClass);
+	for (size_t i = 0; objects && i < m_ObjectCount; ++i)
+		jni::SetObjectArrayElement(objects, i, m_Objects[i]);
+	jlongArray words = jni::Op<jlong>::NewArray(m_WordCount);
+	jni::Op<jlong>::SetArrayRegion(words, 0, m_WordCount, m_Words);
+	jbyteArray tags = jni::Op<jbyte>::NewArray(m_WordCount);
+	jni::Op<jbyte>::SetArrayRegion(tags, 0, m_WordCount, m_Tags);
+	if (!jni::PeekError())
+		jni::Op<jvoid>::CallStaticMethod(s_JNIBridgeClass, executeID, objects, words, tags);
+	Clear();
+	return !jni::PeekError();
+}
+
+void CommandBuffer::Clear()
+{
+	for (size_t i = 0; i < m_StringCount; ++i)
+		jni::DeleteGlobalRef(m_Strings[i]);
+	m_WordCount = 0;
+	m_ObjectCount = 0;
+	m_StringCount = 0;
+	m_MethodCount = 0;
+	m_Receiver = 0;
+	m_ReceiverIndex = -1;
+	m_CommandCount = 0;
+}
+
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+#include <type_traits>
+
+namespace jni
+{
+
+// Records calls whose results aren't needed (setters, Bundle puts, ...) and runs
+// them in java with a single call into bitter.jnibridge.JNIBridge.executeCommands.
+// Recording doesn't call into java; methods are reflected once and cached.
+// Execution stops at the first exception, which Submit reports through jni::CheckError;
+// an argument that can't convert to its parameter type, or a wrong argument count,
+// fails the same way (IllegalArgumentException) instead of desyncing the stream.
+//
+// Receivers and object arguments are not retained: they (local refs included) must
+// stay valid until Submit. Strings passed as const char* are owned by the buffer.
+class CommandBuffer
+{
+public:
+	CommandBuffer();
+	~CommandBuffer();
+
+	template <typename... Args>
+	inline void Call(jobject receiver, jmethodID method, const Args&... args)
+	{
+		if (!Begin(receiver, 0, method, sizeof...(Args)))
+			return;
+		int packed[] = { 0, (Pack(args), 0)... };
+		(void) packed;
+	}
+
+	template <typename... Args>
+	inline void CallStatic(jclass clazz, jmethodID method, const Args&... args)
+	{
+		if (!Begin(0, clazz, method, sizeof...(Args)))
+			return;
+		int packed[] = { 0, (Pack(args), 0)... };
+		(void) packed;
+	}
+
+	// Runs and clears the recorded calls; false if java threw (see jni::CheckError)
+	bool   Submit();
+	void   Clear();
+	inline size_t Size() const { return m_CommandCount; }
+
+private:
+	CommandBuffer(const CommandBuffer& buffer);
+	CommandBuffer& operator = (const CommandBuffer& o);
+
+	struct MethodEntry
+	{
+		jmethodID id;
+		jlong     index;
+	};
+
+	bool  Begin(jobject receiver, jclass clazz, jmethodID method, size_t argCount);
+	jlong AddObject(jobject object);
+	void  Grow(void*& data, size_t& capacity, size_t elementSize);
+
+	// Word tags; java converts numbers to the parameter type (like a C++ implicit
+	// conversion) and rejects objects for primitives, numbers for objects and argument
+	// count mismatches
+	enum
+	{
+		kTagHeader  = 0,
+		kTagInteger = 'I',
+		kTagFloat   = 'F',
+		kTagDouble  = 'D',
+		kTagObject  = 'L'
+	};
+
+	// one word per argument
+	inline void PushWord(jlong word, jbyte tag)
+	{
+		if (m_WordCount == m_WordCapacity)
+		{
+			Grow(reinterpret_cast<void*&>(m_Words), m_WordCapacity, sizeof(jlong));
+			m_Tags = static_cast<jbyte*>(realloc(m_Tags, m_WordCapacity));
+		}
+		m_Tags[m_WordCount] = tag;
+		m_Words[m_WordCount++] = word;
+	}
+
+	inline void Pack(bool value)     { PushWord(value ? 1 : 0, kTagInteger); }
+	inline void Pack(jboolean value) { PushWord(value ? 1 : 0, kTagInteger); }
+	inline void Pack(jbyte value)    { PushWord(value, kTagInteger); }
+	inline void Pack(jchar value)    { PushWord(value, kTagInteger); }
+	inline void Pack(jshort value)   { PushWord(value, kTagInteger); }
+	inline void Pack(jint value)     { PushWord(value, kTagInteger); }
+	inline void Pack(jlong value)    { PushWord(value, kTagInteger); }
+	inline void Pack(jfloat value)   { union { jfloat f; jint i; } bits; bits.f = value; PushWord(bits.i, kTagFloat); }
+	inline void Pack(jdouble value)  { union { jdouble d; jlong l; } bits; bits.d = value; PushWord(bits.l, kTagDouble); }
+	inline void Pack(jobject value)  { PushWord(AddObject(value), kTagObject); }
+	void        Pack(const char* value);
+	// generated wrappers and other jobject types
+	template <typename T>
+	inline typename std::enable_if<std::is_convertible<T, jobject>::value>::type Pack(const T& value) { PushWord(AddObject(static_cast<jobject>(value)), kTagObject); }
+
+	jlong*       m_Words;
+	jbyte*       m_Tags;    // one per word
+	size_t       m_WordCount;
+	size_t       m_WordCapacity;
+	jobject*     m_Objects;
+	size_t       m_ObjectCount;
+	size_t       m_ObjectCapacity;
+	jobject*     m_Strings; // owned, global refs
+	size_t       m_StringCount;
+	size_t       m_StringCapacity;
+	MethodEntry* m_Methods; // methods already in m_Objects
+	size_t       m_MethodCount;
+	size_t       m_MethodCapacity;
+	jobject      m_Receiver;
+	jlong        m_ReceiverIndex;
+	size_t       m_CommandCount;
+};
+
+}
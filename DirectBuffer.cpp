@@ -0,0 +1,49 @@
+#include "DirectBuffer.h"
+
+namespace jni
+{
+
+static jni::Class s_BufferClass("java/nio/Buffer");
+static jni::Class s_ByteOrderClass("java/nio/ByteOrder");
+
+static jobject GetNativeOrder()
+{
+	static jmethodID nativeOrderID = jni::GetStaticMethodID(s_ByteOrderClass, "nativeOrder", "()Ljava/nio/ByteOrder;");
+	static jobject nativeOrder = jni::NewGlobalRef(jni::Op<jobject>::CallStaticMethod(s_ByteOrderClass, nativeOrderID));
+	return nativeOrder;
+}
+
+bool __ResolveBuffer(jobject buffer, jmethodID orderID, size_t elementSize, BufferInfo& info)
+{
+	static jmethodID positionID = jni::GetMethodID(s_BufferClass, "position", "()I");
+	static jmethodID limitID = jni::GetMethodID(s_BufferClass, "limit", "()I");
+	static jmethodID isReadOnlyID = jni::GetMethodID(s_BufferClass, "isReadOnly", "()Z");
+	static jmethodID hasArrayID = jni::GetMethodID(s_BufferClass, "hasArray", "()Z");
+	static jmethodID arrayID = jni::GetMethodID(s_BufferClass, "array", "()Ljava/lang/Object;");
+	static jmethodID arrayOffsetID = jni::GetMethodID(s_BufferClass, "arrayOffset", "()I");
+
+	// heap buffers have no address
+	info.address = static_cast<char*>(jni::GetDirectBufferAddress(buffer));
+	info.position = jni::Op<jint>::CallMethod(buffer, positionID);
+	info.limit = jni::Op<jint>::CallMethod(buffer, limitID);
+	info.readOnly = jni::Op<jboolean>::CallMethod(buffer, isReadOnlyID);
+	info.inPlace = info.address && (elementSize == 1 || jni::IsSameObject(jni::Op<jobject>::CallMethod(buffer, orderID), GetNativeOrder()));
+	info.array = 0;
+	info.arrayOffset = 0;
+	if (info.address)
+		info.capacity = static_cast<jint>(jni::GetDirectBufferCapacity(buffer));
+	else
+	{
+		static jmethodID capacityID = jni::GetMethodID(s_BufferClass, "capacity", "()I");
+		info.capacity = jni::Op<jint>::CallMethod(buffer, capacityID);
+		// read-only heap buffers don't expose their array
+		if (jni::Op<jboolean>::CallMethod(buffer, hasArrayID))
+		{
+			info.array = jni::Op<jobject>::CallMethod(buffer, arrayID);
+			info.arrayOffset = jni::Op<jint>::CallMethod(buffer, arrayOffsetID);
+		}
+	}
+	return !jni::PeekError();
+}
+
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "APIHelper.h"
+
+#include <stdlib.h>
+
+namespace jni
+{
+
+// Per element type java.nio buffer class and method signatures
+template <typename T> struct BufferTraits;
+
+#define JNITL_DEF_BUFFER_TRAITS(jt, t, sig) \
+	template <> \
+	struct BufferTraits<jt> \
+	{ \
+		typedef jt##Array ArrayType; \
+		static jni::Class& GetClass() { static jni::Class clazz("java/nio/" #t "Buffer"); return clazz; } \
+		static const char* View()            { return "as" #t "Buffer"; } \
+		static const char* BufferSignature() { return "()Ljava/nio/" #t "Buffer;"; } \
+		static const char* ArraySignature()  { return "([" sig ")Ljava/nio/" #t "Buffer;"; } \
+	};
+
+JNITL_DEF_BUFFER_TRAITS(jbyte,   Byte,   "B")
+JNITL_DEF_BUFFER_TRAITS(jchar,   Char,   "C")
+JNITL_DEF_BUFFER_TRAITS(jshort,  Short,  "S")
+JNITL_DEF_BUFFER_TRAITS(jint,    Int,    "I")
+JNITL_DEF_BUFFER_TRAITS(jlong,   Long,   "J")
+JNITL_DEF_BUFFER_TRAITS(jfloat,  Float,  "F")
+JNITL_DEF_BUFFER_TRAITS(jdouble, Double, "D")
+
+#undef JNITL_DEF_BUFFER_TRAITS
+
+// java.nio.Buffer state, resolved with one call per property
+struct BufferInfo
+{
+	char*   address;     // direct buffers only
+	jint    position;
+	jint    limit;
+	jint    capacity;
+	bool    inPlace;     // direct and in native order (or bytes)
+	bool    readOnly;
+	jobject array;       // backing array of heap buffers (local ref) or 0
+	jint    arrayOffset;
+};
+
+bool __ResolveBuffer(jobject buffer, jmethodID orderID, size_t elementSize, BufferInfo& info);
+
+// ------------------------------------------------
+// Typed native view of a java.nio buffer, from its position to its limit.
+// Address, bounds and byte order are resolved once. Direct buffers in native
+// order are accessed in place; heap and byte swapped buffers are copied with one
+// bulk region copy and written back by Commit(). A ByteBuffer is viewed through
+// asXBuffer() for wider element types. The java buffer's position is left alone.
+// ------------------------------------------------
+template <typename T>
+class DirectBuffer
+{
+public:
+	explicit DirectBuffer(jobject buffer);
+	~DirectBuffer();
+
+	inline operator bool() const   { return m_Buffer != 0; }
+	inline bool   IsCopy() const   { return m_Copy != 0; }
+	// Writing to a read-only buffer viewed in place is undefined
+	inline bool   IsReadOnly() const { return m_Info.readOnly; }
+
+	inline jint   Position() const { return m_Info.position; }
+	inline jint   Limit() const    { return m_Info.limit; }
+	inline jint   Capacity() const { return m_Info.capacity; }
+
+	// The span [position, limit)
+	inline T*     Data() const     { return m_Data; }
+	inline size_t Size() const     { return m_Size; }
+	inline T*     begin() const    { return m_Data; }
+	inline T*     end() const      { return m_Data + m_Size; }
+
+	// Bounds checked; out of range is a parameter error
+	inline T operator[] (size_t i) const
+	{
+		if (jni::CheckForParameterError(i < m_Size))
+			return T();
+		return m_Data[i];
+	}
+	inline T* At(size_t i) const
+	{
+		if (jni::CheckForParameterError(i < m_Size))
+			return 0;
+		return m_Data + i;
+	}
+
+	// Writes a copy back to java; nothing to do for in place views
+	bool Commit();
+
+private:
+	DirectBuffer(const DirectBuffer& buffer);
+	DirectBuffer& operator = (const DirectBuffer& o);
+
+	typedef typename BufferTraits<T>::ArrayType ArrayType;
+
+	jobject    m_Buffer; // global ref
+	jobject    m_Array;  // backing array, global ref
+	BufferInfo m_Info;
+	T*         m_Data;
+	T*         m_Copy;
+	size_t     m_Size;
+};
+
+template <typename T>
+DirectBuffer<T>::DirectBuffer(jobject buffer)
+: m_Buffer(0)
+, m_Array(0)
+, m_Data(0)
+, m_Copy(0)
+, m_Size(0)
+{
+	typedef BufferTraits<T> Traits;
+	jni::LocalFrame frame;
+	if (jni::CheckForParameterError(buffer != 0))
+		return;
+
+	if (sizeof(T) > 1 && !jni::IsInstanceOf(buffer, Traits::GetClass()))
+	{
+		static jmethodID viewID = jni::GetMethodID(BufferTraits<jbyte>::GetClass(), Traits::View(), Traits::BufferSignature());
+		buffer = jni::Op<jobject>::CallMethod(buffer, viewID);
+	}
+	static jmethodID orderID = jni::GetMethodID(Traits::GetClass(), "order", "()Ljava/nio/ByteOrder;");
+	if (!buffer || !__ResolveBuffer(buffer, orderID, sizeof(T), m_Info))
+		return;
+
+	m_Size = m_Info.limit - m_Info.position;
+	if (m_Info.inPlace)
+	{
+		m_Data = reinterpret_cast<T*>(m_Info.address) + m_Info.position;
+		m_Buffer = jni::NewGlobalRef(buffer);
+		return;
+	}
+
+	m_Copy = static_cast<T*>(malloc((m_Size ? m_Size : 1) * sizeof(T)));
+	if (m_Info.array)
+	{
+		jni::Op<T>::GetArrayRegion(static_cast<ArrayType>(m_Info.array), m_Info.arrayOffset + m_Info.position, m_Size, m_Copy);
+		m_Array = jni::NewGlobalRef(m_Info.array);
+	}
+	else
+	{
+		// relative bulk get on a duplicate, so the callers position stays put
+		static jmethodID duplicateID = jni::GetMethodID(Traits::GetClass(), "duplicate", Traits::BufferSignature());
+		static jmethodID getID = jni::GetMethodID(Traits::GetClass(), "get", Traits::ArraySignature());
+		ArrayType array = jni::Op<T>::NewArray(m_Size);
+		jni::Op<jobject>::CallMethod(jni::Op<jobject>::CallMethod(buffer, duplicateID), getID, array);
+		jni::Op<T>::GetArrayRegion(array, 0, m_Size, m_Copy);
+	}
+	if (jni::PeekError())
+		return;
+	m_Data = m_Copy;
+	m_Buffer = jni::NewGlobalRef(buffer);
+}
+
+template <typename T>
+DirectBuffer<T>::~DirectBuffer()
+{
+	if (m_Buffer)
+		jni::DeleteGlobalRef(m_Buffer);
+	if (m_Array)
+		jni::DeleteGlobalRef(m_Array);
+	free(m_Copy);
+}
+
+template <typename T>
+bool DirectBuffer<T>::Commit()
+{
+	typedef BufferTraits<T> Traits;
+	if (!m_Buffer || !m_Copy)
+		return m_Buffer != 0;
+
+	jni::LocalFrame frame;
+	if (m_Array)
+		jni::Op<T>::SetArrayRegion(static_cast<ArrayType>(m_Array), m_Info.arrayOffset + m_Info.position, m_Size, m_Copy);
+	else
+	{
+		static jmethodID duplicateID = jni::GetMethodID(Traits::GetClass(), "duplicate", Traits::BufferSignature());
+		static jmethodID putID = jni::GetMethodID(Traits::GetClass(), "put", Traits::ArraySignature());
+		ArrayType array = jni::Op<T>::NewArray(m_Size);
+		jni::Op<T>::SetArrayRegion(array, 0, m_Size, m_Copy);
+		jni::Op<jobject>::CallMethod(jni::Op<jobject>::CallMethod(m_Buffer, duplicateID), putID, array);
+	}
+	return !jni::CheckError();
+}
+
+}
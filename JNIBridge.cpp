@@ -318,6 +318,16 @@ jobject ToReflectedMethod(jclass clazz, jmethodID methodID, bool isStatic)
 	JNI_CALL_RETURN(jobject, clazz && methodID, true, env->ToReflectedMethod(clazz, methodID, isStatic));
 }
 
+jobject ToReflectedField(jclass clazz, jfieldID fieldID, bool isStatic)
+{
+	JNI_CALL_RETURN(jobject, clazz && fieldID, true, env->ToReflectedField(clazz, fieldID, isStatic));
+}
+
+jint RegisterNatives(jclass clazz, const JNINativeMethod* methods, jint nMethods)
+{
+	JNI_CALL_RETURN(jint, clazz && methods, true, env->RegisterNatives(clazz, methods, nMethods));
+}
+
 jobject NewObject(jclass clazz, jmethodID methodID, ...)
 {
 	va_list args;
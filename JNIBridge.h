@@ -71,6 +71,9 @@ jmethodID    GetStaticMethodID(jclass clazz, const char* name, const char* signa
 jfieldID     GetStaticFieldID(jclass clazz, const char* name, const char* signature);
 
 jobject      ToReflectedMethod(jclass clazz, jmethodID methodID, bool isStatic);
+jobject      ToReflectedField(jclass clazz, jfieldID fieldID, bool isStatic);
+
+jint         RegisterNatives(jclass clazz, const JNINativeMethod* methods, jint nMethods);
 
 jobject		 NewObject(jclass clazz, jmethodID methodID, ...);
 
@@ -191,6 +194,14 @@ public:
 		va_end(args);
 		return result;
 	}
+	static JT CallMethodV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_CALL_RETURN(JT, object && id, true, static_cast<JT>((env->*CallMethodOP)(object, id, args)));
+	}
+	static JT CallStaticMethodV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL_RETURN(JT, clazz && id, true, static_cast<JT>((env->*CallStaticMethodOP)(clazz, id, args)));
+	}
 };
 
 template <typename JT, typename RT,
@@ -404,6 +415,16 @@ public:
 		va_end(args);
 		return 0;
 	}
+	static jvoid CallMethodV(jobject object, jmethodID id, va_list args)
+	{
+		JNI_CALL(object && id, true, env->CallVoidMethodV(object, id, args));
+		return 0;
+	}
+	static jvoid CallStaticMethodV(jclass clazz, jmethodID id, va_list args)
+	{
+		JNI_CALL(clazz && id, true, env->CallStaticVoidMethodV(clazz, id, args));
+		return 0;
+	}
 };
 
 }
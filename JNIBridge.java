@@ -1,11 +1,19 @@
 package bitter.jnibridge;
 
+import java.io.*;
+import java.lang.ref.*;
 import java.lang.reflect.*;
+import java.nio.*;
+import java.util.*;
 
 public class JNIBridge
 {
 	static native Object invoke(long ptr, Class clazz, Method method, Object[] args);
 	static native void   delete(long ptr);
+	// Drops all results memoized by generated code (APIGenerator --memoize), e.g. on configuration changes
+	public static native void invalidateMemos();
+	static native void   releaseBuffer(long ptr);
+	static native void   unmapBuffer(long ptr);
 
 	static Object newInterfaceProxy(final long ptr, final Class[] interfaces)
 	{
@@ -17,6 +25,401 @@ public class JNIBridge
 		((InterfaceProxy) Proxy.getInvocationHandler(proxy)).disable();
 	}
 
+	// Replays a native jni::CommandBuffer. Each command is a method index, a receiver index
+	// (-1 for static methods) and one word per parameter; objects are indices (-1 for null).
+	// Stops at the first exception and rethrows it to native.
+	static void executeCommands(final Object[] objects, final long[] words, final byte[] tags) throws Throwable
+	{
+		int i = 0;
+		while (i < words.length)
+		{
+			final Method method = (Method) objects[(int) words[i++]];
+			final int receiver = (int) words[i++];
+			final int count = (int) words[i++];
+			final Class[] types = method.getParameterTypes();
+			if (count != types.length)
+				throw new IllegalArgumentException(method + ": " + count + " arguments recorded, " + types.length + " expected");
+			final Object[] args = new Object[types.length];
+			for (int arg = 0; arg < types.length; ++arg, ++i)
+				args[arg] = decodeWord(method, arg, types[arg], words[i], tags[i], objects);
+			if (!method.isAccessible())
+				method.setAccessible(true);
+			try
+			{
+				method.invoke(receiver < 0 ? null : objects[receiver], args);
+			}
+			catch (InvocationTargetException e)
+			{
+				throw e.getCause();
+			}
+		}
+	}
+
+	// Numbers convert to the parameter type like a C++ implicit conversion would; 'I' integral, 'F' / 'D' bits, 'L' object index
+	private static Object decodeWord(final Method method, final int arg, final Class type, final long word, final byte tag, final Object[] objects)
+	{
+		if ((tag == 'L') == type.isPrimitive())
+			throw new IllegalArgumentException(method + ": argument " + arg + " is " + (tag == 'L' ? "an object" : "a number") + ", " + type.getName() + " expected");
+		if (tag == 'L')
+			return word < 0 ? null : objects[(int) word];
+		final boolean real = tag == 'F' || tag == 'D';
+		final double value = tag == 'F' ? Float.intBitsToFloat((int) word) : Double.longBitsToDouble(word);
+		final long integer = real ? (long) value : word;
+		if (type == Integer.TYPE)
+			return Integer.valueOf((int) integer);
+		if (type == Boolean.TYPE)
+			return Boolean.valueOf(real ? value != 0 : word != 0);
+		if (type == Float.TYPE)
+			return Float.valueOf(real ? (float) value : (float) word);
+		if (type == Long.TYPE)
+			return Long.valueOf(integer);
+		if (type == Double.TYPE)
+			return Double.valueOf(real ? value : (double) word);
+		if (type == Short.TYPE)
+			return Short.valueOf((short) integer);
+		if (type == Byte.TYPE)
+			return Byte.valueOf((byte) integer);
+		return Character.valueOf((char) integer);
+	}
+
+	// Reads one member of each element of an Object[] or Collection for a native jni::MapCall or
+	// jni::MapField, into a new array of the prototype's type. Null elements (or a null member)
+	// read as 0.
+	static Object mapMembers(final Object objects, final Member member, final Object prototype) throws Throwable
+	{
+		final Object[] elements = flatten(objects);
+		final Object results = Array.newInstance(prototype.getClass().getComponentType(), elements.length);
+		if (member == null)
+			return results;
+		final AccessibleObject accessible = (AccessibleObject) member;
+		if (!accessible.isAccessible())
+			accessible.setAccessible(true);
+		if (member instanceof Field)
+		{
+			final Field field = (Field) member;
+			for (int i = 0; i < elements.length; ++i)
+				if (elements[i] != null)
+					Array.set(results, i, field.get(elements[i]));
+			return results;
+		}
+		final Method method = (Method) member;
+		try
+		{
+			for (int i = 0; i < elements.length; ++i)
+				if (elements[i] != null)
+					Array.set(results, i, method.invoke(elements[i]));
+		}
+		catch (InvocationTargetException e)
+		{
+			throw e.getCause();
+		}
+		return results;
+	}
+
+	// Elements of an Object[], Map (keys and values alternating), Collection, Iterable, Iterator or Enumeration
+	static Object[] flatten(final Object collection)
+	{
+		if (collection instanceof Object[])
+			return (Object[]) collection;
+		if (collection instanceof Map)
+		{
+			final Map map = (Map) collection;
+			final Object[] elements = new Object[map.size() * 2];
+			int i = 0;
+			for (Object entry : map.entrySet())
+			{
+				elements[i++] = ((Map.Entry) entry).getKey();
+				elements[i++] = ((Map.Entry) entry).getValue();
+			}
+			return elements;
+		}
+		if (collection instanceof Collection)
+			return ((Collection) collection).toArray();
+		final ArrayList<Object> elements = new ArrayList<Object>();
+		if (collection instanceof Iterable)
+			for (Object element : (Iterable) collection)
+				elements.add(element);
+		else if (collection instanceof Iterator)
+			for (Iterator iterator = (Iterator) collection; iterator.hasNext();)
+				elements.add(iterator.next());
+		else if (collection instanceof Enumeration)
+			for (Enumeration enumeration = (Enumeration) collection; enumeration.hasMoreElements();)
+				elements.add(enumeration.nextElement());
+		else
+			throw new IllegalArgumentException("not a collection: " + collection);
+		return elements.toArray();
+	}
+
+	// Next elements of an Iterator or Enumeration into 'batch' (jni::ObjectIterator); fewer than batch.length means the end
+	static int fetch(final Object source, final Object[] batch)
+	{
+		int count = 0;
+		if (source instanceof Iterator)
+			for (Iterator iterator = (Iterator) source; count < batch.length && iterator.hasNext();)
+				batch[count++] = iterator.next();
+		else if (source instanceof Enumeration)
+			for (Enumeration enumeration = (Enumeration) source; count < batch.length && enumeration.hasMoreElements();)
+				batch[count++] = enumeration.nextElement();
+		else
+			throw new IllegalArgumentException("not an iterator: " + source);
+		Arrays.fill(batch, count, batch.length, null);
+		return count;
+	}
+
+	// Boxed elements unboxed into a new array of the prototype's type (jni::ToVector); nulls read as 0
+	static Object toPrimitives(final Object collection, final Object prototype)
+	{
+		final Object[] elements = flatten(collection);
+		final Object results = Array.newInstance(prototype.getClass().getComponentType(), elements.length);
+		for (int i = 0; i < elements.length; ++i)
+			if (elements[i] != null)
+				Array.set(results, i, elements[i]);
+		return results;
+	}
+
+	// Elements as one UTF-8 block and a length per element (-1 for null): { byte[], int[] }
+	static Object[] encodeStrings(final Object collection) throws UnsupportedEncodingException
+	{
+		final Object[] elements = flatten(collection);
+		final byte[][] encoded = new byte[elements.length][];
+		final int[] lengths = new int[elements.length];
+		int total = 0;
+		for (int i = 0; i < elements.length; ++i)
+		{
+			if (elements[i] == null)
+			{
+				lengths[i] = -1;
+				continue;
+			}
+			encoded[i] = String.valueOf(elements[i]).getBytes("UTF-8");
+			lengths[i] = encoded[i].length;
+			total += lengths[i];
+		}
+		final byte[] data = new byte[total];
+		int offset = 0;
+		for (int i = 0; i < elements.length; ++i)
+		{
+			if (encoded[i] == null)
+				continue;
+			System.arraycopy(encoded[i], 0, data, offset, encoded[i].length);
+			offset += encoded[i].length;
+		}
+		return new Object[] { data, lengths };
+	}
+
+	// Any array (primitives are boxed)
+	static List newList(final Object array)
+	{
+		final int length = Array.getLength(array);
+		final ArrayList<Object> list = new ArrayList<Object>(length);
+		for (int i = 0; i < length; ++i)
+			list.add(Array.get(array, i));
+		return list;
+	}
+
+	static List newStringList(final byte[] data, final int[] lengths) throws UnsupportedEncodingException
+	{
+		final ArrayList<String> list = new ArrayList<String>(lengths.length);
+		int offset = 0;
+		for (int i = 0; i < lengths.length; offset += lengths[i++])
+			list.add(new String(data, offset, lengths[i], "UTF-8"));
+		return list;
+	}
+
+	// Keys and values alternating
+	static Map newStringMap(final byte[] data, final int[] lengths) throws UnsupportedEncodingException
+	{
+		final HashMap<String, String> map = new HashMap<String, String>(lengths.length);
+		int offset = 0;
+		for (int i = 0; i + 1 < lengths.length; i += 2)
+		{
+			final String key = new String(data, offset, lengths[i], "UTF-8");
+			offset += lengths[i];
+			map.put(key, new String(data, offset, lengths[i + 1], "UTF-8"));
+			offset += lengths[i + 1];
+		}
+		return map;
+	}
+
+	// Native struct mirrors (APIGenerator --mirror); 'types' holds one JNI signature character per field
+	static Object newMirrorLayout(final Class clazz, final String[] names, final String types, final int[] offsets, final int size) throws NoSuchFieldException
+	{
+		final Field[] fields = new Field[names.length];
+		for (int i = 0; i < names.length; ++i)
+		{
+			for (Class type = clazz; fields[i] == null; type = type.getSuperclass())
+			{
+				if (type == null)
+					throw new NoSuchFieldException(names[i]);
+				try
+				{
+					fields[i] = type.getDeclaredField(names[i]);
+				}
+				catch (NoSuchFieldException e)
+				{
+				}
+			}
+			fields[i].setAccessible(true);
+		}
+		return new MirrorLayout(fields, types.toCharArray(), offsets, size);
+	}
+
+	// Copies between one object (or each element of an Object[]) and the native struct(s) in 'buffer'
+	static void copyMirrors(final Object layout, final Object objects, final ByteBuffer buffer, final boolean writeBack) throws IllegalAccessException
+	{
+		final MirrorLayout mirror = (MirrorLayout) layout;
+		buffer.order(ByteOrder.nativeOrder());
+		if (!(objects instanceof Object[]))
+		{
+			mirror.copy(objects, buffer, 0, writeBack);
+			return;
+		}
+		final Object[] elements = (Object[]) objects;
+		for (int i = 0; i < elements.length; ++i)
+			if (elements[i] != null)
+				mirror.copy(elements[i], buffer, i * mirror.m_Size, writeBack);
+	}
+
+	private static class MirrorLayout
+	{
+		final Field[] m_Fields;
+		final char[] m_Types;
+		final int[] m_Offsets;
+		final int m_Size;
+
+		public MirrorLayout(final Field[] fields, final char[] types, final int[] offsets, final int size)
+		{
+			m_Fields = fields;
+			m_Types = types;
+			m_Offsets = offsets;
+			m_Size = size;
+		}
+
+		void copy(final Object object, final ByteBuffer buffer, final int base, final boolean writeBack) throws IllegalAccessException
+		{
+			for (int i = 0; i < m_Fields.length; ++i)
+			{
+				final Field field = m_Fields[i];
+				final int at = base + m_Offsets[i];
+				if (writeBack && Modifier.isFinal(field.getModifiers()))
+					continue;
+				switch (m_Types[i])
+				{
+					case 'Z':
+						if (writeBack) field.setBoolean(object, buffer.get(at) != 0); else buffer.put(at, (byte) (field.getBoolean(object) ? 1 : 0));
+						break;
+					case 'B':
+						if (writeBack) field.setByte(object, buffer.get(at)); else buffer.put(at, field.getByte(object));
+						break;
+					case 'C':
+						if (writeBack) field.setChar(object, buffer.getChar(at)); else buffer.putChar(at, field.getChar(object));
+						break;
+					case 'S':
+						if (writeBack) field.setShort(object, buffer.getShort(at)); else buffer.putShort(at, field.getShort(object));
+						break;
+					case 'I':
+						if (writeBack) field.setInt(object, buffer.getInt(at)); else buffer.putInt(at, field.getInt(object));
+						break;
+					case 'J':
+						if (writeBack) field.setLong(object, buffer.getLong(at)); else buffer.putLong(at, field.getLong(object));
+						break;
+					case 'F':
+						if (writeBack) field.setFloat(object, buffer.getFloat(at)); else buffer.putFloat(at, field.getFloat(object));
+						break;
+					case 'D':
+						if (writeBack) field.setDouble(object, buffer.getDouble(at)); else buffer.putDouble(at, field.getDouble(object));
+						break;
+				}
+			}
+		}
+	}
+
+	// Direct buffers handed over by a native BufferArena or MappedBuffer; their memory goes back to the
+	// arena (or is unmapped) once collected
+	private static final ReferenceQueue<Object> s_ReleasedBuffers = new ReferenceQueue<Object>();
+	private static final Set<Reference<Object>> s_HandedOffBuffers = new HashSet<Reference<Object>>();
+	private static Thread s_BufferCleaner;
+
+	// Views of an arena slice are tracked like handed off buffers: on ART a view doesn't
+	// reference its parent, so only its own phantom reference can tell when it's gone
+	static ByteBuffer sliceBuffer(final ByteBuffer buffer, final int offset, final int length, final long ptr)
+	{
+		final ByteBuffer view = buffer.duplicate();
+		view.clear();
+		view.limit(offset + length);
+		view.position(offset);
+		return trackView(view.slice(), ptr);
+	}
+
+	static ByteBuffer duplicateBuffer(final ByteBuffer buffer, final long ptr)
+	{
+		return trackView(buffer.duplicate(), ptr);
+	}
+
+	private static ByteBuffer trackView(final ByteBuffer view, final long ptr)
+	{
+		trackBuffer(new BufferReference(view, ptr, false, s_ReleasedBuffers));
+		return view;
+	}
+
+	static void handOffBuffer(final Object buffer, final long ptr)
+	{
+		trackBuffer(new BufferReference(buffer, ptr, false, s_ReleasedBuffers));
+	}
+
+	static void mapBuffer(final Object buffer, final long ptr)
+	{
+		trackBuffer(new BufferReference(buffer, ptr, true, s_ReleasedBuffers));
+	}
+
+	private static void trackBuffer(final BufferReference reference)
+	{
+		synchronized (s_HandedOffBuffers)
+		{
+			s_HandedOffBuffers.add(reference);
+			if (s_BufferCleaner != null)
+				return;
+			s_BufferCleaner = new Thread("JNIBridge buffer cleaner") {
+				public void run()
+				{
+					try
+					{
+						while (true)
+						{
+							BufferReference reference = (BufferReference) s_ReleasedBuffers.remove();
+							synchronized (s_HandedOffBuffers)
+							{
+								s_HandedOffBuffers.remove(reference);
+							}
+							if (reference.m_Mapped)
+								unmapBuffer(reference.m_Ptr);
+							else
+								releaseBuffer(reference.m_Ptr);
+						}
+					}
+					catch (InterruptedException e)
+					{
+					}
+				}
+			};
+			s_BufferCleaner.setDaemon(true);
+			s_BufferCleaner.start();
+		}
+	}
+
+	private static class BufferReference extends PhantomReference<Object>
+	{
+		final long m_Ptr;
+		final boolean m_Mapped;
+
+		public BufferReference(final Object buffer, final long ptr, final boolean mapped, final ReferenceQueue<Object> queue)
+		{
+			super(buffer, queue);
+			m_Ptr = ptr;
+			m_Mapped = mapped;
+		}
+	}
+
 	private static class InterfaceProxy implements InvocationHandler
 	{
 		private Object m_InvocationLock = new Object[0];
@@ -0,0 +1,59 @@
+#include "MapCall.h"
+#include "APIHelper.h"
+
+namespace jni
+{
+
+static jni::Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
+
+// java flattens the input once (Maps, Iterables, Iterators, ... as in mapMembers);
+// an Iterator can't be walked twice
+static jobjectArray Flatten(jobject objects)
+{
+	static jmethodID flattenID = jni::GetStaticMethodID(s_JNIBridgeClass, "flatten", "(Ljava/lang/Object;)[Ljava/lang/Object;");
+	return static_cast<jobjectArray>(jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, flattenID, objects));
+}
+
+// Any non-null element's class; the reflected member is cached per (class, ID)
+static jclass GetElementClass(jobjectArray elements)
+{
+	size_t length = elements ? jni::GetArrayLength(elements) : 0;
+	for (size_t i = 0; i < length; ++i)
+	{
+		jobject element = jni::GetObjectArrayElement(elements, i);
+		if (element)
+			return jni::GetObjectClass(element);
+	}
+	return 0;
+}
+
+// A null member (nothing to reflect it with) maps every element to 0
+static jarray MapMembers(jobject objects, jobject member, jarray prototype)
+{
+	static jmethodID mapID = jni::GetStaticMethodID(s_JNIBridgeClass, "mapMembers", "(Ljava/lang/Object;Ljava/lang/reflect/Member;Ljava/lang/Object;)Ljava/lang/Object;");
+	if (jni::PeekError())
+		return 0;
+	return static_cast<jarray>(jni::Op<jobject>::CallStaticMethod(s_JNIBridgeClass, mapID, objects, member, prototype));
+}
+
+jarray __MapMethod(jobject objects, jmethodID methodID, jarray prototype)
+{
+	if (jni::CheckForParameterError(objects && methodID && prototype))
+		return 0;
+	jobjectArray elements = Flatten(objects);
+	jclass clazz = GetElementClass(elements);
+	jobject method = clazz ? jni::ReflectMethod(clazz, methodID, false) : 0;
+	return elements ? MapMembers(elements, method, prototype) : 0;
+}
+
+jarray __MapField(jobject objects, jfieldID fieldID, jarray prototype)
+{
+	if (jni::CheckForParameterError(objects && fieldID && prototype))
+		return 0;
+	jobjectArray elements = Flatten(objects);
+	jclass clazz = GetElementClass(elements);
+	jobject field = clazz ? jni::ReflectField(clazz, fieldID, false) : 0;
+	return elements ? MapMembers(elements, field, prototype) : 0;
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+#include <stdlib.h>
+
+namespace jni
+{
+
+// Reads one primitive member of every element of an Object[], Collection, Map, Iterable, ...
+// with a call into bitter.jnibridge.JNIBridge.flatten and one into mapMembers. The results are copied
+// into native memory in one region copy; null elements read as 0. Java converts the
+// values to T (widening only), so T needn't be the member's exact type.
+// 'prototype' is an empty array of the result type.
+jarray __MapMethod(jobject objects, jmethodID methodID, jarray prototype);
+jarray __MapField(jobject objects, jfieldID fieldID, jarray prototype);
+
+template <typename T>
+class MapResult
+{
+public:
+	~MapResult() { free(m_Data); }
+
+	// false if java failed (see jni::CheckError)
+	inline operator bool() const { return m_Data != 0; }
+
+	inline T*     Data() const  { return m_Data; }
+	inline size_t Size() const  { return m_Size; }
+	inline T*     begin() const { return m_Data; }
+	inline T*     end() const   { return m_Data + m_Size; }
+
+	// Bounds checked; out of range is a parameter error
+	inline T operator[] (size_t i) const
+	{
+		if (jni::CheckForParameterError(i < m_Size))
+			return T();
+		return m_Data[i];
+	}
+
+protected:
+	typedef decltype(jni::Op<T>::NewArray(0)) ArrayType;
+
+	MapResult() : m_Data(0), m_Size(0) {}
+
+	void Copy(jarray results)
+	{
+		if (!results)
+			return;
+		m_Size = jni::GetArrayLength(results);
+		m_Data = static_cast<T*>(malloc((m_Size ? m_Size : 1) * sizeof(T)));
+		jni::Op<T>::GetArrayRegion(static_cast<ArrayType>(results), 0, m_Size, m_Data);
+	}
+
+private:
+	MapResult(const MapResult& result);
+	MapResult& operator = (const MapResult& o);
+
+	T*     m_Data;
+	size_t m_Size;
+};
+
+// e.g. jni::MapCall<jfloat> xs(entities, getXID); calls a no argument method
+template <typename T>
+class MapCall : public MapResult<T>
+{
+public:
+	MapCall(jobject objects, jmethodID methodID)
+	{
+		jni::LocalFrame frame;
+		this->Copy(__MapMethod(objects, methodID, jni::Op<T>::NewArray(0)));
+	}
+};
+
+// e.g. jni::MapField<jint> ids(entities, idFieldID)
+template <typename T>
+class MapField : public MapResult<T>
+{
+public:
+	MapField(jobject objects, jfieldID fieldID)
+	{
+		jni::LocalFrame frame;
+		this->Copy(__MapField(objects, fieldID, jni::Op<T>::NewArray(0)));
+	}
+};
+
+}
@@ -0,0 +1,135 @@
+#include "MappedBuffer.h"
+#include "APIHelper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace jni
+{
+
+struct Mapping
+{
+	void*  base;
+	size_t length;
+};
+
+static jni::Class s_JNIBridgeClass("bitter/jnibridge/JNIBridge");
+static jni::Class s_ByteBufferClass("java/nio/ByteBuffer");
+
+JNIEXPORT void JNICALL Java_bitter_jnibridge_JNIBridge_unmapBuffer(JNIEnv* env, jclass clazz, jlong ptr)
+{
+	MappedBuffer::__Unmap(reinterpret_cast<void*>(ptr));
+}
+
+bool MappedBuffer::__Register()
+{
+	jni::LocalFrame frame;
+	char unmapMethodName[] = "unmapBuffer";
+	char unmapMethodSignature[] = "(J)V";
+
+	JNINativeMethod nativeMappedFunction[] = {
+		{unmapMethodName, unmapMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_unmapBuffer}
+	};
+
+	jni::RegisterNatives(s_JNIBridgeClass, nativeMappedFunction, sizeof(nativeMappedFunction) / sizeof(nativeMappedFunction[0]));
+	return !jni::CheckError();
+}
+
+void MappedBuffer::__Unmap(void* ptr)
+{
+	Mapping* mapping = static_cast<Mapping*>(ptr);
+	munmap(mapping->base, mapping->length);
+	delete mapping;
+}
+
+static int GetAdvice(MappedBuffer::Advice advice)
+{
+	switch (advice)
+	{
+		case MappedBuffer::kAdviceSequential: return MADV_SEQUENTIAL;
+		case MappedBuffer::kAdviceRandom:     return MADV_RANDOM;
+		case MappedBuffer::kAdviceWillNeed:   return MADV_WILLNEED;
+		default:                              return MADV_NORMAL;
+	}
+}
+
+jobject MappedBuffer::Map(const char* path, jlong offset, jlong length, Advice advice)
+{
+	if (jni::CheckForParameterError(path != 0))
+		return 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	jobject result = Map(fd, offset, length, advice);
+	int error = errno;
+	close(fd);
+	errno = error;
+	return result;
+}
+
+jobject MappedBuffer::Map(int fd, jlong offset, jlong length, Advice advice)
+{
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		return 0;
+	if (length < 0)
+		length = info.st_size - offset;
+	if (jni::CheckForParameterError(offset >= 0 && length >= 0 && offset + length <= info.st_size && length <= INT_MAX))
+		return 0;
+
+	// mmap wants a page aligned offset; the buffer starts within the first page
+	jlong pageSize = sysconf(_SC_PAGESIZE);
+	jlong start = offset - offset % pageSize;
+	size_t mappedLength = static_cast<size_t>(length + (offset - start));
+	static jmethodID readOnlyID = jni::GetMethodID(s_ByteBufferClass, "asReadOnlyBuffer", "()Ljava/nio/ByteBuffer;");
+	if (!mappedLength) // empty ranges can't be mapped; still a read-only direct buffer, over no memory
+	{
+		static char s_Empty;
+		jobject empty = jni::NewDirectByteBuffer(&s_Empty, 0);
+		jobject readOnly = empty ? jni::Op<jobject>::CallMethod(empty, readOnlyID) : 0;
+		jni::DeleteLocalRef(empty);
+		return readOnly;
+	}
+	// java's cleaner thread (shared with BufferArena) dies without unmapBuffer
+	static bool registered = __Register();
+	if (!registered)
+	{
+		jni::CheckForParameterError(false);
+		return 0;
+	}
+	void* base = mmap(0, mappedLength, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(start));
+	if (base == MAP_FAILED)
+		return 0;
+	madvise(base, mappedLength, GetAdvice(advice));
+
+	Mapping* mapping = new Mapping;
+	mapping->base = base;
+	mapping->length = mappedLength;
+
+	jobject buffer = jni::NewDirectByteBuffer(static_cast<char*>(base) + (offset - start), length);
+	if (!buffer)
+	{
+		__Unmap(mapping);
+		return 0;
+	}
+
+	// java tracks the buffer the caller gets: on ART views share memory but don't reference
+	// their parent, so tracking the writable buffer could unmap under the read-only one
+	static jmethodID mapID = jni::GetStaticMethodID(s_JNIBridgeClass, "mapBuffer", "(Ljava/lang/Object;J)V");
+	jobject readOnly = jni::Op<jobject>::CallMethod(buffer, readOnlyID);
+	if (!readOnly)
+	{
+		jni::DeleteLocalRef(buffer);
+		__Unmap(mapping);
+		return 0;
+	}
+	jni::Op<jvoid>::CallStaticMethod(s_JNIBridgeClass, mapID, readOnly, reinterpret_cast<jlong>(mapping));
+	jni::DeleteLocalRef(buffer);
+	return readOnly;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+namespace jni
+{
+
+// Maps a file (range) and hands it to java as a read-only direct ByteBuffer.
+// The mapping is released once java has collected that buffer. Views derived from
+// it (slices, duplicates) don't extend its lifetime on every VM (ART's don't
+// reference their parent): keep the returned buffer reachable while they're used.
+class MappedBuffer
+{
+public:
+	enum Advice
+	{
+		kAdviceNormal,
+		kAdviceSequential,
+		kAdviceRandom,
+		kAdviceWillNeed
+	};
+
+	// Returns a local ref or 0; on i/o failures errno tells why.
+	// A negative length maps up to the end of the file; buffers are limited to 2GB.
+	static jobject Map(const char* path, jlong offset = 0, jlong length = -1, Advice advice = kAdviceSequential);
+	static jobject Map(int fd, jlong offset = 0, jlong length = -1, Advice advice = kAdviceSequential);
+
+	// Registers bitter.jnibridge.JNIBridge.unmapBuffer; Map does it when needed
+	static bool    __Register();
+	static void    __Unmap(void* mapping);
+};
+
+}
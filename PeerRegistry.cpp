@@ -0,0 +1,281 @@
+#include "PeerRegistry.h"
+#include "API.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+namespace jni
+{
+
+struct PeerEntry
+{
+	jint       hash;
+	jobject    object; // weak global ref
+	void*      peer;
+	PeerEntry* next;
+};
+
+enum
+{
+	kPeerStripes    = 64,  // power of two
+	kPeerMinBuckets = 256  // power of two, >= kPeerStripes
+};
+
+// Lookups and updates share s_TableLock and serialize per stripe; rehashing takes it exclusively
+static pthread_rwlock_t s_TableLock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t  s_StripeLocks[kPeerStripes];
+static PeerEntry**      s_Buckets;
+static size_t           s_BucketCount;
+static size_t           s_EntryCount;
+
+static void InitializeTable()
+{
+	pthread_rwlock_wrlock(&s_TableLock);
+	if (!__atomic_load_n(&s_Buckets, __ATOMIC_ACQUIRE))
+	{
+		for (int i = 0; i < kPeerStripes; ++i)
+			pthread_mutex_init(&s_StripeLocks[i], NULL);
+		s_BucketCount = kPeerMinBuckets;
+		__atomic_store_n(&s_Buckets, static_cast<PeerEntry**>(calloc(kPeerMinBuckets, sizeof(PeerEntry*))), __ATOMIC_RELEASE);
+	}
+	pthread_rwlock_unlock(&s_TableLock);
+}
+
+// Checked locally; an unrelated pending error mustn't make every call fail
+static bool IdentityHashCode(jobject object, jint& hash)
+{
+	static jmethodID methodID = jni::GetStaticMethodID(java::lang::System::__CLASS, "identityHashCode", "(Ljava/lang/Object;)I");
+	JNIEnv* env = jni::GetEnv();
+	if (!env || !methodID)
+		return false;
+	hash = env->CallStaticIntMethod(java::lang::System::__CLASS, methodID, object);
+	return !jni::CheckForExceptionError(env);
+}
+
+static inline size_t BucketIndex(jint hash, size_t bucketCount)
+{
+	return static_cast<size_t>(static_cast<uint32_t>(hash)) & (bucketCount - 1);
+}
+
+// jni::IsSameObject treats null as a parameter error
+static inline bool IsCollected(PeerEntry* entry)
+{
+	JNIEnv* env = jni::GetEnv();
+	return env && env->IsSameObject(entry->object, NULL);
+}
+
+static void DeleteEntry(PeerEntry* entry)
+{
+	jni::DeleteWeakGlobalRef(entry->object);
+	delete entry;
+}
+
+static void Rehash(size_t expectedBucketCount)
+{
+	pthread_rwlock_wrlock(&s_TableLock);
+	if (s_BucketCount == expectedBucketCount)
+	{
+		size_t bucketCount = s_BucketCount * 2;
+		PeerEntry** buckets = static_cast<PeerEntry**>(calloc(bucketCount, sizeof(PeerEntry*)));
+		for (size_t i = 0; i < s_BucketCount; ++i)
+		{
+			for (PeerEntry* entry = s_Buckets[i]; entry; )
+			{
+				PeerEntry* next = entry->next;
+				size_t index = BucketIndex(entry->hash, bucketCount);
+				entry->next = buckets[index];
+				buckets[index] = entry;
+				entry = next;
+			}
+		}
+		free(s_Buckets);
+		s_Buckets = buckets;
+		s_BucketCount = bucketCount;
+	}
+	pthread_rwlock_unlock(&s_TableLock);
+}
+
+// --------------------------------------------------------------------------------------
+// PeerRegistry
+// --------------------------------------------------------------------------------------
+jfieldID PeerRegistry::UsePeerField(jclass clazz, const char* fieldName)
+{
+	return jni::GetFieldID(clazz, fieldName, "J");
+}
+
+bool PeerRegistry::Register(jobject object, void* peer, jfieldID peerField)
+{
+	if (jni::CheckForParameterError(object && peerField))
+		return false;
+	jni::Op<jlong>::SetField(object, peerField, reinterpret_cast<jlong>(peer));
+	return !jni::PeekError();
+}
+
+bool PeerRegistry::Unregister(jobject object, jfieldID peerField)
+{
+	return Register(object, 0, peerField);
+}
+
+void* PeerRegistry::Lookup(jobject object, jfieldID peerField)
+{
+	if (jni::CheckForParameterError(object && peerField))
+		return 0;
+	return reinterpret_cast<void*>(jni::Op<jlong>::GetField(object, peerField));
+}
+
+bool PeerRegistry::Register(jobject object, void* peer)
+{
+	if (!object)
+		return false;
+
+	jint hash;
+	if (!IdentityHashCode(object, hash))
+		return false;
+
+	if (!__atomic_load_n(&s_Buckets, __ATOMIC_ACQUIRE))
+		InitializeTable();
+
+	pthread_rwlock_rdlock(&s_TableLock);
+	size_t bucketCount = s_BucketCount;
+	size_t index = BucketIndex(hash, bucketCount);
+	pthread_mutex_t& stripe = s_StripeLocks[index & (kPeerStripes - 1)];
+	pthread_mutex_lock(&stripe);
+
+	bool found = false;
+	for (PeerEntry** link = &s_Buckets[index]; *link; )
+	{
+		PeerEntry* entry = *link;
+		if (entry->hash == hash && jni::IsSameObject(entry->object, object))
+		{
+			entry->peer = peer;
+			found = true;
+			break;
+		}
+		if (IsCollected(entry))
+		{
+			*link = entry->next;
+			DeleteEntry(entry);
+			__sync_sub_and_fetch(&s_EntryCount, 1);
+			continue;
+		}
+		link = &entry->next;
+	}
+
+	jobject weak = found ? 0 : jni::NewWeakGlobalRef(object);
+	if (weak)
+	{
+		PeerEntry* entry = new PeerEntry;
+		entry->hash   = hash;
+		entry->object = weak;
+		entry->peer   = peer;
+		entry->next   = s_Buckets[index];
+		s_Buckets[index] = entry;
+	}
+	size_t entryCount = weak ? __sync_add_and_fetch(&s_EntryCount, 1) : s_EntryCount;
+
+	pthread_mutex_unlock(&stripe);
+	pthread_rwlock_unlock(&s_TableLock);
+
+	if (entryCount > bucketCount * 2)
+		Rehash(bucketCount);
+	return found || weak;
+}
+
+bool PeerRegistry::Unregister(jobject object)
+{
+	if (!object)
+		return false;
+
+	if (!__atomic_load_n(&s_Buckets, __ATOMIC_ACQUIRE))
+		return false;
+
+	jint hash;
+	if (!IdentityHashCode(object, hash))
+		return false;
+
+	pthread_rwlock_rdlock(&s_TableLock);
+	size_t index = BucketIndex(hash, s_BucketCount);
+	pthread_mutex_t& stripe = s_StripeLocks[index & (kPeerStripes - 1)];
+	pthread_mutex_lock(&stripe);
+
+	bool found = false;
+	for (PeerEntry** link = &s_Buckets[index]; *link; link = &(*link)->next)
+	{
+		PeerEntry* entry = *link;
+		if (entry->hash == hash && jni::IsSameObject(entry->object, object))
+		{
+			*link = entry->next;
+			DeleteEntry(entry);
+			__sync_sub_and_fetch(&s_EntryCount, 1);
+			found = true;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&stripe);
+	pthread_rwlock_unlock(&s_TableLock);
+	return found;
+}
+
+void* PeerRegistry::Lookup(jobject object)
+{
+	if (!object)
+		return 0;
+
+	if (!__atomic_load_n(&s_Buckets, __ATOMIC_ACQUIRE))
+		return 0;
+
+	jint hash;
+	if (!IdentityHashCode(object, hash))
+		return 0;
+
+	pthread_rwlock_rdlock(&s_TableLock);
+	size_t index = BucketIndex(hash, s_BucketCount);
+	pthread_mutex_t& stripe = s_StripeLocks[index & (kPeerStripes - 1)];
+	pthread_mutex_lock(&stripe);
+
+	void* peer = 0;
+	for (PeerEntry* entry = s_Buckets[index]; entry; entry = entry->next)
+	{
+		if (entry->hash == hash && jni::IsSameObject(entry->object, object))
+		{
+			peer = entry->peer;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&stripe);
+	pthread_rwlock_unlock(&s_TableLock);
+	return peer;
+}
+
+void PeerRegistry::Purge()
+{
+	if (!__atomic_load_n(&s_Buckets, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_rwlock_wrlock(&s_TableLock);
+	for (size_t i = 0; i < s_BucketCount; ++i)
+	{
+		for (PeerEntry** link = &s_Buckets[i]; *link; )
+		{
+			PeerEntry* entry = *link;
+			if (IsCollected(entry))
+			{
+				*link = entry->next;
+				DeleteEntry(entry);
+				--s_EntryCount;
+				continue;
+			}
+			link = &entry->next;
+		}
+	}
+	pthread_rwlock_unlock(&s_TableLock);
+}
+
+size_t PeerRegistry::Size()
+{
+	return __atomic_load_n(&s_EntryCount, __ATOMIC_ACQUIRE);
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+namespace jni
+{
+
+// Maps java objects to the native objects that mirror them.
+// Entries hold weak global refs and never keep the java object alive.
+class PeerRegistry
+{
+public:
+	static bool  Register(jobject object, void* peer);
+	static bool  Unregister(jobject object);
+	static void* Lookup(jobject object);
+
+	template <typename T>
+	static inline T* Lookup(jobject object) { return static_cast<T*>(Lookup(object)); }
+
+	// Classes with a 'long' peer field skip the table: the caller states the field, so
+	// there is no per call class check. A runtime opt-in; generated classes have no such field.
+	static jfieldID UsePeerField(jclass clazz, const char* fieldName);
+	static bool  Register(jobject object, void* peer, jfieldID peerField);
+	static bool  Unregister(jobject object, jfieldID peerField);
+	static void* Lookup(jobject object, jfieldID peerField);
+
+	template <typename T>
+	static inline T* Lookup(jobject object, jfieldID peerField) { return static_cast<T*>(Lookup(object, peerField)); }
+
+	// Drops entries whose java object has been collected
+	static void  Purge();
+	static size_t Size();
+};
+
+}
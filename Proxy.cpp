@@ -1,5 +1,9 @@
 #include "Proxy.h"
 
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
 namespace jni
 {
 
@@ -14,7 +18,12 @@ JNIEXPORT jobject JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_in
 
 JNIEXPORT void JNICALL Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_delete(JNIEnv* env, jobject thiz, jlong ptr)
 {
-	delete (ProxyInvoker*)ptr;
+	ProxyInvoker::__Release((ProxyInvoker*)ptr);
+}
+
+JNIEXPORT void JNICALL Java_bitter_jnibridge_JNIBridge_invalidateMemos(JNIEnv* env, jclass clazz)
+{
+	jni::InvalidateMemos();
 }
 
 bool ProxyInvoker::__Register()
@@ -25,16 +34,354 @@ bool ProxyInvoker::__Register()
 	char invokeMethodSignature[] = "(JLjava/lang/Class;Ljava/lang/reflect/Method;[Ljava/lang/Object;)Ljava/lang/Object;";
 	char deleteMethodName[] = "delete";
 	char deleteMethodSignature[] = "(J)V";
+	char invalidateMemosMethodName[] = "invalidateMemos";
+	char invalidateMemosMethodSignature[] = "()V";
 
 	JNINativeMethod nativeProxyFunction[] = {
 		{invokeMethodName, invokeMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_invoke},
-		{deleteMethodName, deleteMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_delete}
+		{deleteMethodName, deleteMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_00024InterfaceProxy_delete},
+		{invalidateMemosMethodName, invalidateMemosMethodSignature, (void*) Java_bitter_jnibridge_JNIBridge_invalidateMemos}
 	};
 
-	if (nativeProxyClass) jni::GetEnv()->RegisterNatives(nativeProxyClass, nativeProxyFunction, 2); // <-- fix this
+	jni::RegisterNatives(nativeProxyClass, nativeProxyFunction, sizeof(nativeProxyFunction) / sizeof(nativeProxyFunction[0]));
 	return !jni::CheckError();
 }
 
+// --------------------------------------------------------------------------------------
+// Async dispatch
+// --------------------------------------------------------------------------------------
+// Calls without a proxy are never posted by proxies; workers treat them as 'quit'
+// (or, for a flush, signal once every call queued before them has run)
+class ProxyQuitCall : public ProxyCall
+{
+public:
+	ProxyQuitCall(bool quit = true) : m_Quit(quit) {}
+	virtual void Invoke() {}
+
+public:
+	const bool m_Quit;
+};
+
+class ProxyFlushCall : public ProxyQuitCall
+{
+public:
+	ProxyFlushCall() : ProxyQuitCall(false) { sem_init(&m_Done, 0, 0); }
+	~ProxyFlushCall() { sem_destroy(&m_Done); }
+	virtual void Invoke() { sem_post(&m_Done); }
+
+public:
+	sem_t m_Done;
+};
+
+// Intrusive multi producer / single consumer queue (Dmitry Vyukov)
+class ProxyCallQueue
+{
+public:
+	ProxyCallQueue() : m_Head(&m_Stub), m_Tail(&m_Stub) {}
+
+	void Push(ProxyCall* call)
+	{
+		__atomic_store_n(&call->m_Next, (ProxyCall*)0, __ATOMIC_RELAXED);
+		ProxyCall* prev = __atomic_exchange_n(&m_Head, call, __ATOMIC_ACQ_REL);
+		__atomic_store_n(&prev->m_Next, call, __ATOMIC_RELEASE);
+	}
+
+	// May return NULL while a producer is between exchanging m_Head and linking m_Next
+	ProxyCall* Pop()
+	{
+		ProxyCall* tail = m_Tail;
+		ProxyCall* next = __atomic_load_n(&tail->m_Next, __ATOMIC_ACQUIRE);
+		if (tail == &m_Stub)
+		{
+			if (!next)
+				return 0;
+			m_Tail = tail = next;
+			next = __atomic_load_n(&next->m_Next, __ATOMIC_ACQUIRE);
+		}
+		if (next)
+		{
+			m_Tail = next;
+			return tail;
+		}
+		if (tail != __atomic_load_n(&m_Head, __ATOMIC_ACQUIRE))
+			return 0;
+		Push(&m_Stub);
+		next = __atomic_load_n(&tail->m_Next, __ATOMIC_ACQUIRE);
+		if (next)
+		{
+			m_Tail = next;
+			return tail;
+		}
+		return 0;
+	}
+
+private:
+	ProxyCall*          m_Head;
+	ProxyCall*          m_Tail;
+	ProxyQuitCall       m_Stub;
+};
+
+struct ProxyWorker
+{
+	pthread_t       thread;
+	sem_t           signal;
+	ProxyCallQueue  queue;
+};
+
+static pthread_rwlock_t  s_DispatchLock = PTHREAD_RWLOCK_INITIALIZER; // Post reads, Start / Stop write
+static ProxyWorker*      s_Workers;
+static volatile unsigned s_WorkerCount;
+static volatile unsigned s_NextWorker;
+static volatile unsigned s_Posted;
+static volatile unsigned s_Executed;
+static volatile unsigned s_MaxDepth;
+static __thread ProxyInvoker* s_Executing; // proxy whose callback this worker is running
+
+void* ProxyDispatcher::Run(void* arg)
+{
+	ProxyWorker* worker = static_cast<ProxyWorker*>(arg);
+	jni::ThreadScope scope;
+	jni::AttachCurrentThread();
+
+	bool quit = false;
+	while (!quit)
+	{
+		while (sem_wait(&worker->signal) != 0)
+			; // EINTR
+
+		ProxyCall* call;
+		while (!(call = worker->queue.Pop()))
+			sched_yield();
+
+		if (!call->m_Proxy)
+		{
+			// a flush call may be gone once invoked
+			quit = static_cast<ProxyQuitCall*>(call)->m_Quit;
+			call->Invoke();
+			continue;
+		}
+
+		{
+			jni::LocalFrame frame;
+			s_Executing = call->m_Proxy;
+			call->Invoke();
+			s_Executing = 0;
+		}
+		jni::CheckError(); // nobody is listening for errors from async callbacks
+
+		__sync_add_and_fetch(&s_Executed, 1);
+		call->m_Proxy->__Complete(call);
+	}
+	return 0;
+}
+
+bool ProxyDispatcher::Start(unsigned workers)
+{
+	if (workers == 0)
+		return false;
+
+	pthread_rwlock_wrlock(&s_DispatchLock);
+	bool started = s_WorkerCount != 0;
+	if (!started)
+	{
+		s_Workers = new ProxyWorker[workers];
+		for (unsigned i = 0; i < workers; ++i)
+		{
+			sem_init(&s_Workers[i].signal, 0, 0);
+			pthread_create(&s_Workers[i].thread, NULL, ProxyDispatcher::Run, &s_Workers[i]);
+		}
+		__atomic_store_n(&s_WorkerCount, workers, __ATOMIC_RELEASE);
+	}
+	pthread_rwlock_unlock(&s_DispatchLock);
+	return !started;
+}
+
+void ProxyDispatcher::Stop()
+{
+	// Detach the pool under the write lock; once it's held no Post is still pushing onto it.
+	// Joining happens outside the lock, so callbacks that post while draining don't deadlock
+	// (they start a new pool).
+	pthread_rwlock_wrlock(&s_DispatchLock);
+	unsigned workers = s_WorkerCount;
+	ProxyWorker* pool = s_Workers;
+	ProxyQuitCall* quit = workers ? new ProxyQuitCall[workers] : 0;
+	for (unsigned i = 0; i < workers; ++i)
+	{
+		// queued callbacks are drained before the workers see the quit call
+		pool[i].queue.Push(&quit[i]);
+		sem_post(&pool[i].signal);
+	}
+	__atomic_store_n(&s_WorkerCount, 0, __ATOMIC_RELEASE);
+	s_Workers = 0;
+	pthread_rwlock_unlock(&s_DispatchLock);
+
+	for (unsigned i = 0; i < workers; ++i)
+	{
+		pthread_join(pool[i].thread, NULL);
+		sem_destroy(&pool[i].signal);
+	}
+	delete[] quit;
+	delete[] pool;
+}
+
+void ProxyDispatcher::Flush()
+{
+	// a callback waiting for its own worker would never wake up
+	if (s_Executing)
+		return;
+
+	pthread_rwlock_rdlock(&s_DispatchLock);
+	unsigned workers = s_WorkerCount;
+	ProxyFlushCall* flush = workers ? new ProxyFlushCall[workers] : 0;
+	for (unsigned i = 0; i < workers; ++i)
+	{
+		s_Workers[i].queue.Push(&flush[i]);
+		sem_post(&s_Workers[i].signal);
+	}
+	pthread_rwlock_unlock(&s_DispatchLock);
+
+	for (unsigned i = 0; i < workers; ++i)
+		while (sem_wait(&flush[i].m_Done) != 0)
+			; // EINTR
+	delete[] flush;
+}
+
+void ProxyDispatcher::GetStats(Stats* stats)
+{
+	unsigned executed = __atomic_load_n(&s_Executed, __ATOMIC_ACQUIRE);
+	unsigned posted   = __atomic_load_n(&s_Posted, __ATOMIC_ACQUIRE);
+	stats->workers  = __atomic_load_n(&s_WorkerCount, __ATOMIC_ACQUIRE);
+	stats->posted   = posted;
+	stats->executed = executed;
+	stats->depth    = posted - executed;
+	stats->maxDepth = s_MaxDepth;
+}
+
+void ProxyDispatcher::Post(ProxyCall* call, bool ordered)
+{
+	// the read lock keeps Stop from detaching the pool while the call is pushed
+	pthread_rwlock_rdlock(&s_DispatchLock);
+	unsigned workers;
+	while (!(workers = s_WorkerCount))
+	{
+		pthread_rwlock_unlock(&s_DispatchLock);
+		Start();
+		pthread_rwlock_rdlock(&s_DispatchLock);
+	}
+
+	// Keep every callback of an ordered proxy on the same (single consumer) worker
+	unsigned index = ordered
+		? static_cast<unsigned>(reinterpret_cast<uintptr_t>(call->m_Proxy) >> 4) % workers
+		: __sync_fetch_and_add(&s_NextWorker, 1) % workers;
+
+	unsigned depth = __sync_add_and_fetch(&s_Posted, 1) - s_Executed;
+	for (unsigned maxDepth = s_MaxDepth; depth > maxDepth; maxDepth = s_MaxDepth)
+		if (__sync_bool_compare_and_swap(&s_MaxDepth, maxDepth, depth))
+			break;
+
+	ProxyWorker& worker = s_Workers[index];
+	worker.queue.Push(call);
+	sem_post(&worker.signal);
+	pthread_rwlock_unlock(&s_DispatchLock);
+}
+
+void ProxyInvoker::__Enqueue(ProxyCall* call)
+{
+	call->m_Proxy = this;
+	__sync_add_and_fetch(&m_References, 1);
+	ProxyDispatcher::Post(call, m_Dispatch == kProxyDispatchAsyncOrdered);
+}
+
+void ProxyInvoker::__Complete(ProxyCall* call)
+{
+	delete call;
+	__Release(this);
+}
+
+void ProxyInvoker::__CheckDrained()
+{
+	// 0 means we are being deleted by the last completed callback; more than the owner's
+	// reference means callbacks are queued, which would run against a destroyed object
+	if (__atomic_load_n(&m_References, __ATOMIC_ACQUIRE) > 1)
+		jni::FatalError(s_Executing == this
+			? "async proxy deleted from its own callback; use Destroy()"
+			: "async proxy deleted with callbacks queued; use Destroy()");
+}
+
+void ProxyInvoker::__Release(ProxyInvoker* proxy)
+{
+	if (!__sync_sub_and_fetch(&proxy->m_References, 1))
+		delete proxy;
+}
+
+// --------------------------------------------------------------------------------------
+// Native footprint
+// --------------------------------------------------------------------------------------
+static size_t   s_FootprintBytes;
+static size_t   s_FootprintHighWater;
+static size_t   s_FootprintThreshold;
+static size_t   s_FootprintNextReclaim;
+static unsigned s_FootprintReclaims;
+static int      s_FootprintReclaiming;
+
+ProxyObject::~ProxyObject()
+{
+	__sync_sub_and_fetch(&s_FootprintBytes, m_NativeFootprint);
+}
+
+void ProxyObject::SetNativeFootprint(size_t bytes)
+{
+	size_t total = __sync_add_and_fetch(&s_FootprintBytes, bytes - m_NativeFootprint);
+	m_NativeFootprint = bytes;
+
+	for (size_t highWater = s_FootprintHighWater; total > highWater; highWater = s_FootprintHighWater)
+		if (__sync_bool_compare_and_swap(&s_FootprintHighWater, highWater, total))
+			break;
+
+	size_t nextReclaim = __atomic_load_n(&s_FootprintNextReclaim, __ATOMIC_ACQUIRE);
+	if (nextReclaim && total >= nextReclaim)
+		Reclaim();
+}
+
+void ProxyObject::SetFootprintThreshold(size_t bytes)
+{
+	__atomic_store_n(&s_FootprintThreshold, bytes, __ATOMIC_RELEASE);
+	__atomic_store_n(&s_FootprintNextReclaim, bytes, __ATOMIC_RELEASE);
+}
+
+void ProxyObject::GetFootprintStats(FootprintStats* stats)
+{
+	stats->bytes     = __atomic_load_n(&s_FootprintBytes, __ATOMIC_ACQUIRE);
+	stats->highWater = __atomic_load_n(&s_FootprintHighWater, __ATOMIC_ACQUIRE);
+	stats->threshold = __atomic_load_n(&s_FootprintThreshold, __ATOMIC_ACQUIRE);
+	stats->reclaims  = __atomic_load_n(&s_FootprintReclaims, __ATOMIC_ACQUIRE);
+}
+
+void ProxyObject::Reclaim()
+{
+	// Only one reclaim at a time; finalizers releasing proxies may call back in here
+	if (!__sync_bool_compare_and_swap(&s_FootprintReclaiming, 0, 1))
+		return;
+
+	// Unreachable proxies release their native state from InterfaceProxy.finalize; async
+	// ones only once their queued callbacks have run, so drain the dispatcher as well
+	java::lang::System::Gc();
+	java::lang::System::RunFinalization();
+	ProxyDispatcher::Flush();
+	__sync_add_and_fetch(&s_FootprintReclaims, 1);
+
+	// Don't keep collecting if the remaining footprint is legitimately live
+	size_t threshold = __atomic_load_n(&s_FootprintThreshold, __ATOMIC_ACQUIRE);
+	size_t remaining = __atomic_load_n(&s_FootprintBytes, __ATOMIC_ACQUIRE);
+	if (threshold)
+		__atomic_store_n(&s_FootprintNextReclaim, remaining < threshold ? threshold : remaining + threshold / 2, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&s_FootprintReclaiming, 0, __ATOMIC_RELEASE);
+}
+
+// --------------------------------------------------------------------------------------
+// ProxyObject
+// --------------------------------------------------------------------------------------
 ::jint ProxyObject::HashCode() const
 {
 	return java::lang::System::IdentityHashCode(java::lang::Object(__ProxyObject()));
@@ -76,8 +423,8 @@ bool ProxyObject::__TryInvoke(jclass clazz, jmethodID methodID, jobjectArray arg
 		jni::GetMethodID(java::lang::Object::__CLASS, "equals", "(Ljava/lang/Object;)Z"),
 		jni::GetMethodID(java::lang::Object::__CLASS, "toString", "()Ljava/lang/String;")
 	};
-	if (methodIDs[0] == methodID) { *result = jni::NewLocalRef(static_cast<java::lang::Integer>(HashCode())); *success = true; return true; }
-	if (methodIDs[1] == methodID) { *result = jni::NewLocalRef(static_cast<java::lang::Boolean>(Equals(::java::lang::Object(jni::GetObjectArrayElement(args, 0))))); *success = true; return true; }
+	if (methodIDs[0] == methodID) { *result = jni::Box(HashCode()); *success = true; return true; }
+	if (methodIDs[1] == methodID) { *result = jni::Box(Equals(::java::lang::Object(jni::GetObjectArrayElement(args, 0)))); *success = true; return true; }
 	if (methodIDs[2] == methodID) {	*result = jni::NewLocalRef(static_cast<java::lang::String>(ToString())); *success = true;	return true; }
 
 	return false;
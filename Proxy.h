@@ -11,6 +11,28 @@ class ProxyObject : public virtual ProxyInvoker
 public:
 	virtual jobject __Invoke(jclass clazz, jmethodID mid, jobjectArray args);
 
+// Native memory held by live proxies; java only sees the (tiny) proxy object
+public:
+	struct FootprintStats
+	{
+		size_t   bytes;      // currently declared by live proxies
+		size_t   highWater;  // high-water mark of bytes
+		size_t   threshold;  // 0 disables reclamation
+		unsigned reclaims;
+	};
+
+	static void SetFootprintThreshold(size_t bytes);
+	static void GetFootprintStats(FootprintStats* stats);
+	static void Reclaim();
+
+protected:
+	ProxyObject() : m_NativeFootprint(0) {}
+	virtual ~ProxyObject();
+
+	// May trigger a reclaim (gc + finalization) once the tally passes the threshold
+	void SetNativeFootprint(size_t bytes);
+	inline size_t GetNativeFootprint() const { return m_NativeFootprint; }
+
 // These functions are special and always forwarded
 protected:
 	virtual ::jint HashCode() const;
@@ -24,21 +46,36 @@ protected:
 protected:
 	static jobject NewInstance(void* nativePtr, const jobject* interfaces, size_t interfaces_len);
 	static void    DisableInstance(jobject proxy);
+
+private:
+	size_t m_NativeFootprint;
 };
 
 template <class RefAllocator, class ...TX>
 class ProxyGenerator : public ProxyObject, public TX::__Proxy...
 {
 protected:
-	ProxyGenerator() : m_ProxyObject(NewInstance(this, (jobject[]){TX::__CLASS...}, sizeof...(TX)))	{ }
+	ProxyGenerator(ProxyDispatch dispatch) : m_ProxyObject(NewInstance(this, (jobject[]){TX::__CLASS...}, sizeof...(TX)))	{ __SetDispatch(dispatch); }
 
+	// Deleting an async proxy with callbacks still queued is a fatal error (they would run
+	// against a destroyed object); release native owned async proxies with Destroy().
 	virtual ~ProxyGenerator()
 	{
 		DisableInstance(__ProxyObject());
+		__CheckDrained();
 	}
 
 	virtual ::jobject __ProxyObject() const { return m_ProxyObject; }
 
+public:
+	// Java stops calling the proxy; it is deleted once its queued callbacks have run
+	// (right away if none are). May be called from the proxy's own callbacks.
+	void Destroy()
+	{
+		DisableInstance(__ProxyObject());
+		__Release(this);
+	}
+
 private:
 	template<typename... Args> inline void DummyInvoke(Args&&...) {}
 	virtual bool __InvokeInternal(jclass clazz, jmethodID mid, jobjectArray args, jobject* result)
@@ -51,7 +88,16 @@ private:
 	Ref<RefAllocator, jobject> m_ProxyObject;
 };
 
-template <class ...TX> class Proxy     : public ProxyGenerator<GlobalRefAllocator, TX...> {};
-template <class ...TX> class WeakProxy : public ProxyGenerator<WeakGlobalRefAllocator, TX...> {};
+template <class ...TX> class Proxy : public ProxyGenerator<GlobalRefAllocator, TX...>
+{
+public:
+	explicit Proxy(ProxyDispatch dispatch = kProxyDispatchSync) : ProxyGenerator<GlobalRefAllocator, TX...>(dispatch) {}
+};
+
+template <class ...TX> class WeakProxy : public ProxyGenerator<WeakGlobalRefAllocator, TX...>
+{
+public:
+	explicit WeakProxy(ProxyDispatch dispatch = kProxyDispatchSync) : ProxyGenerator<WeakGlobalRefAllocator, TX...>(dispatch) {}
+};
 
 }
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "RingBuffer.h"
+#include "APIHelper.h"
+
+#include <string.h>
+
+namespace jni
+{
+
+enum
+{
+	kRingHeader       = 256,
+	kRingJavaWaiter   = 1,
+	kRingNativeWaiter = 2
+};
+
+static jni::Class s_RingBufferClass("bitter/jnibridge/RingBuffer");
+static jni::Class s_ByteBufferClass("java/nio/ByteBuffer");
+
+static inline size_t FrameSize(size_t size) { return sizeof(jint) + ((size + 3) & ~size_t(3)); }
+
+// A frame that doesn't fit before the end of the ring also needs the space it skips
+static inline bool Fits(jlong head, jlong tail, size_t frame, size_t capacity)
+{
+	size_t toEnd = capacity - (head & (capacity - 1));
+	size_t needed = frame <= toEnd ? frame : toEnd + frame;
+	return static_cast<size_t>(head - tail) + needed <= capacity;
+}
+
+// --------------------------------------------------------------------------------------
+// Natives
+// --------------------------------------------------------------------------------------
+JNIEXPORT void JNICALL Java_bitter_jnibridge_RingBuffer_nativeWake(JNIEnv* env, jclass clazz, jlong ptr)
+{
+	reinterpret_cast<RingBuffer*>(ptr)->__Wake();
+}
+
+bool RingBuffer::__Register()
+{
+	jni::LocalFrame frame;
+	char wakeName[] = "nativeWake";
+	char wakeSignature[] = "(J)V";
+
+	JNINativeMethod nativeRingFunction[] = {
+		{wakeName, wakeSignature, (void*) Java_bitter_jnibridge_RingBuffer_nativeWake}
+	};
+
+	jni::RegisterNatives(s_RingBufferClass, nativeRingFunction, sizeof(nativeRingFunction) / sizeof(nativeRingFunction[0]));
+	return !jni::CheckError();
+}
+
+// --------------------------------------------------------------------------------------
+// RingBuffer
+// --------------------------------------------------------------------------------------
+RingBuffer::RingBuffer(size_t capacity)
+: m_Capacity(64)
+, m_Base(0)
+, m_Storage(0)
+, m_Object(0)
+{
+	while (m_Capacity < capacity)
+		m_Capacity <<= 1;
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Changed, NULL);
+
+	// java owns the storage; it stays valid for the java side after this object is gone
+	jni::LocalFrame frame;
+	static jmethodID allocateID = jni::GetStaticMethodID(s_ByteBufferClass, "allocateDirect", "(I)Ljava/nio/ByteBuffer;");
+	static jmethodID constructorID = jni::GetMethodID(s_RingBufferClass, "<init>", "(Ljava/nio/ByteBuffer;IJ)V");
+	jobject storage = jni::Op<jobject>::CallStaticMethod(s_ByteBufferClass, allocateID, static_cast<jint>(kRingHeader + m_Capacity));
+	m_Base = storage ? static_cast<char*>(jni::GetDirectBufferAddress(storage)) : 0;
+	if (!m_Base)
+		return;
+	memset(m_Base, 0, kRingHeader);
+	m_Storage = jni::NewGlobalRef(storage);
+	m_Object = jni::NewGlobalRef(jni::NewObject(s_RingBufferClass, constructorID, storage,
+		static_cast<jint>(m_Capacity), reinterpret_cast<jlong>(this)));
+}
+
+RingBuffer::~RingBuffer()
+{
+	Close();
+	if (m_Object)
+	{
+		// after this java won't call __Wake anymore
+		static jmethodID detachID = jni::GetMethodID(s_RingBufferClass, "detach", "()V");
+		jni::Op<jvoid>::CallMethod(m_Object, detachID);
+		jni::DeleteGlobalRef(m_Object);
+	}
+	if (m_Storage)
+		jni::DeleteGlobalRef(m_Storage);
+	pthread_cond_destroy(&m_Changed);
+	pthread_mutex_destroy(&m_Lock);
+}
+
+void RingBuffer::__Wake()
+{
+	pthread_mutex_lock(&m_Lock);
+	pthread_cond_broadcast(&m_Changed);
+	pthread_mutex_unlock(&m_Lock);
+}
+
+void RingBuffer::WakeOther(jint* waiting)
+{
+	switch (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+	{
+		case kRingNativeWaiter:
+			__Wake();
+			break;
+		case kRingJavaWaiter:
+		{
+			static jmethodID wakeID = jni::GetMethodID(s_RingBufferClass, "wake", "()V");
+			jni::Op<jvoid>::CallMethod(m_Object, wakeID);
+			break;
+		}
+	}
+}
+
+bool RingBuffer::TryWrite(const void* data, size_t size)
+{
+	size_t frame = FrameSize(size);
+	if (!m_Base || frame > m_Capacity / 2 || __atomic_load_n(Closed(), __ATOMIC_ACQUIRE))
+		return false;
+
+	jlong head = __atomic_load_n(Head(), __ATOMIC_RELAXED);
+	jlong tail = __atomic_load_n(Tail(), __ATOMIC_ACQUIRE);
+	if (!Fits(head, tail, frame, m_Capacity))
+		return false;
+	size_t position = head & (m_Capacity - 1);
+	size_t toEnd = m_Capacity - position;
+
+	if (frame > toEnd)
+	{
+		*reinterpret_cast<jint*>(Data() + position) = -1;
+		head += toEnd;
+		position = 0;
+	}
+	*reinterpret_cast<jint*>(Data() + position) = static_cast<jint>(size);
+	memcpy(Data() + position + sizeof(jint), data, size);
+	__atomic_store_n(Head(), head + frame, __ATOMIC_SEQ_CST);
+	WakeOther(Consumer());
+	return true;
+}
+
+ssize_t RingBuffer::TryRead(void* data, size_t size)
+{
+	if (!m_Base)
+		return -1;
+	jlong tail = __atomic_load_n(Tail(), __ATOMIC_RELAXED);
+	jlong head = __atomic_load_n(Head(), __ATOMIC_ACQUIRE);
+	for (;;)
+	{
+		if (tail == head)
+			return -1;
+		size_t position = tail & (m_Capacity - 1);
+		jint length = *reinterpret_cast<jint*>(Data() + position);
+		if (length < 0)
+		{
+			tail += m_Capacity - position;
+			continue;
+		}
+		if (static_cast<size_t>(length) > size)
+		{
+			__atomic_store_n(Tail(), tail, __ATOMIC_SEQ_CST); // keep skipped padding consumed
+			return length;
+		}
+		memcpy(data, Data() + position + sizeof(jint), length);
+		__atomic_store_n(Tail(), tail + FrameSize(length), __ATOMIC_SEQ_CST);
+		WakeOther(Producer());
+		return length;
+	}
+}
+
+bool RingBuffer::Wait(jint* waiting, bool producer, size_t size)
+{
+	pthread_mutex_lock(&m_Lock);
+	__atomic_store_n(waiting, static_cast<jint>(kRingNativeWaiter), __ATOMIC_SEQ_CST);
+	bool closed = __atomic_load_n(Closed(), __ATOMIC_SEQ_CST);
+	jlong head = __atomic_load_n(Head(), __ATOMIC_SEQ_CST);
+	jlong tail = __atomic_load_n(Tail(), __ATOMIC_SEQ_CST);
+	bool blocked = producer ? !Fits(head, tail, FrameSize(size), m_Capacity) : head == tail;
+	if (!closed && blocked)
+		pthread_cond_wait(&m_Changed, &m_Lock);
+	__atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&m_Lock);
+	return !closed;
+}
+
+bool RingBuffer::Write(const void* data, size_t size)
+{
+	if (!m_Base || FrameSize(size) > m_Capacity / 2)
+		return false;
+	while (!TryWrite(data, size))
+		if (!Wait(Producer(), true, size))
+			return false;
+	return true;
+}
+
+ssize_t RingBuffer::Read(void* data, size_t size)
+{
+	if (!m_Base)
+		return -1;
+	ssize_t length;
+	while ((length = TryRead(data, size)) < 0)
+		if (!Wait(Consumer(), false, 0))
+			return TryRead(data, size); // drain what was written before closing
+	return length;
+}
+
+void RingBuffer::Close()
+{
+	if (!m_Base)
+		return;
+	__atomic_store_n(Closed(), 1, __ATOMIC_SEQ_CST);
+	WakeOther(Producer());
+	WakeOther(Consumer());
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace jni
+{
+
+// Single producer / single consumer frame queue shared with bitter.jnibridge.RingBuffer.
+// Indices and frames live in one direct ByteBuffer; either side may produce or consume.
+// Transfers don't call into the other side unless it is waiting (idle).
+//
+// Layout, offsets in bytes; indices are byte counters, frames are an int length
+// (-1: skip to the start) followed by the data, padded to 4 bytes:
+//    0 head              (producer)
+//   64 tail              (consumer)
+//  128 producer waiting  (0, 1: java, 2: native)
+//  192 consumer waiting
+//  196 closed
+//  256 data
+class RingBuffer
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit RingBuffer(size_t capacity);
+	~RingBuffer();
+
+	// bitter.jnibridge.RingBuffer over the same storage (global ref)
+	inline jobject GetJavaObject() const { return m_Object; }
+	inline size_t  GetCapacity() const   { return m_Capacity; }
+
+	// Producer; false if the frame doesn't fit (yet) or the ring is closed.
+	// Frames (plus 4 bytes) can take up to half the capacity.
+	bool    TryWrite(const void* data, size_t size);
+	bool    Write(const void* data, size_t size);
+
+	// Consumer; returns the frame size, -1 if empty (closed for Read).
+	// A frame larger than 'size' is left in the ring.
+	ssize_t TryRead(void* data, size_t size);
+	ssize_t Read(void* data, size_t size);
+
+	// Wakes and fails waiting producers and consumers on both sides
+	void    Close();
+
+	// Registers the bitter.jnibridge.RingBuffer natives
+	static bool __Register();
+	void        __Wake();
+
+private:
+	RingBuffer(const RingBuffer& ring);
+	RingBuffer& operator = (const RingBuffer& o);
+
+	inline char*  Data() const     { return m_Base + 256; }
+	inline jlong* Head() const     { return reinterpret_cast<jlong*>(m_Base); }
+	inline jlong* Tail() const     { return reinterpret_cast<jlong*>(m_Base + 64); }
+	inline jint*  Producer() const { return reinterpret_cast<jint*>(m_Base + 128); }
+	inline jint*  Consumer() const { return reinterpret_cast<jint*>(m_Base + 192); }
+	inline jint*  Closed() const   { return reinterpret_cast<jint*>(m_Base + 196); }
+
+	void WakeOther(jint* waiting);
+	bool Wait(jint* waiting, bool producer, size_t size);
+
+	size_t          m_Capacity;
+	char*           m_Base;
+	jobject         m_Storage; // direct ByteBuffer, global ref
+	jobject         m_Object;  // bitter.jnibridge.RingBuffer, global ref
+	pthread_mutex_t m_Lock;
+	pthread_cond_t  m_Changed;
+};
+
+}
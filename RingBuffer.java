@@ -0,0 +1,227 @@
+package bitter.jnibridge;
+
+import java.nio.*;
+
+// Java side of a native jni::RingBuffer (see RingBuffer.h for the shared layout).
+// Single producer / single consumer; either side may be java or native.
+public class RingBuffer
+{
+	private static final int HEAD             = 0;
+	private static final int TAIL             = 64;
+	private static final int PRODUCER_WAITING = 128;
+	private static final int CONSUMER_WAITING = 192;
+	private static final int CLOSED           = 196;
+	private static final int DATA             = 256;
+
+	private static final int JAVA_WAITER      = 1;
+	private static final int NATIVE_WAITER    = 2;
+
+	// Volatile access to the indices: plain direct buffer accesses ordered by volatile
+	// accesses of s_Fence, which every VM fences with full barriers; no JNI calls and
+	// no proprietary API (sun.misc.Unsafe) needed.
+	private static volatile int s_Fence;
+
+	static native void nativeWake(long ptr);
+
+	private final ByteBuffer m_Storage;
+	private final ByteBuffer m_Reader;
+	private final ByteBuffer m_Writer;
+	private final int m_Capacity;
+	private final Object m_Lock = new Object[0];
+	private long m_Ptr;
+
+	RingBuffer(final ByteBuffer storage, final int capacity, final long ptr)
+	{
+		m_Storage = storage.order(ByteOrder.nativeOrder());
+		m_Reader = storage.duplicate();
+		m_Writer = storage.duplicate();
+		m_Capacity = capacity;
+		m_Ptr = ptr;
+	}
+
+	public int capacity() { return m_Capacity; }
+
+	// Producer; false if the frame doesn't fit (yet) or the ring is closed.
+	// Frames (plus 4 bytes) can take up to half the capacity.
+	public boolean offer(final byte[] data, final int offset, final int length)
+	{
+		final int frame = frameSize(length);
+		if (frame > m_Capacity / 2 || getInt(CLOSED) != 0)
+			return false;
+
+		long head = getLong(HEAD);
+		final long tail = getLong(TAIL);
+		if (!fits(head, tail, frame))
+			return false;
+		int position = (int) (head & (m_Capacity - 1));
+		final int toEnd = m_Capacity - position;
+		if (frame > toEnd)
+		{
+			m_Storage.putInt(DATA + position, -1);
+			head += toEnd;
+			position = 0;
+		}
+		m_Storage.putInt(DATA + position, length);
+		m_Writer.clear();
+		m_Writer.position(DATA + position + 4);
+		m_Writer.put(data, offset, length);
+		putLong(HEAD, head + frame);
+		wakeOther(CONSUMER_WAITING);
+		return true;
+	}
+
+	public boolean put(final byte[] data, final int offset, final int length) throws InterruptedException
+	{
+		if (frameSize(length) > m_Capacity / 2)
+			return false;
+		while (!offer(data, offset, length))
+			if (!await(PRODUCER_WAITING, length))
+				return false;
+		return true;
+	}
+
+	// Consumer; returns the frame size, -1 if empty (closed for take).
+	// A frame larger than 'length' is left in the ring.
+	public int poll(final byte[] data, final int offset, final int length)
+	{
+		long tail = getLong(TAIL);
+		final long head = getLong(HEAD);
+		while (tail != head)
+		{
+			final int position = (int) (tail & (m_Capacity - 1));
+			final int size = m_Storage.getInt(DATA + position);
+			if (size < 0)
+			{
+				tail += m_Capacity - position;
+				continue;
+			}
+			if (size > length)
+			{
+				putLong(TAIL, tail);
+				return size;
+			}
+			m_Reader.clear();
+			m_Reader.position(DATA + position + 4);
+			m_Reader.get(data, offset, size);
+			putLong(TAIL, tail + frameSize(size));
+			wakeOther(PRODUCER_WAITING);
+			return size;
+		}
+		return -1;
+	}
+
+	public int take(final byte[] data, final int offset, final int length) throws InterruptedException
+	{
+		int size;
+		while ((size = poll(data, offset, length)) < 0)
+			if (!await(CONSUMER_WAITING, 0))
+				return poll(data, offset, length); // drain what was written before closing
+		return size;
+	}
+
+	// Wakes and fails waiting producers and consumers on both sides
+	public void close()
+	{
+		putInt(CLOSED, 1);
+		wakeOther(PRODUCER_WAITING);
+		wakeOther(CONSUMER_WAITING);
+	}
+
+	// Called natively when a java side is waiting
+	void wake()
+	{
+		synchronized (m_Lock)
+		{
+			m_Lock.notifyAll();
+		}
+	}
+
+	// Called natively when the native ring goes away
+	void detach()
+	{
+		synchronized (m_Lock)
+		{
+			m_Ptr = 0;
+		}
+	}
+
+	private boolean await(final int waiting, final int length) throws InterruptedException
+	{
+		synchronized (m_Lock)
+		{
+			putInt(waiting, JAVA_WAITER);
+			try
+			{
+				final boolean closed = getInt(CLOSED) != 0;
+				final long head = getLong(HEAD);
+				final long tail = getLong(TAIL);
+				final boolean blocked = waiting == PRODUCER_WAITING ? !fits(head, tail, frameSize(length)) : head == tail;
+				if (!closed && blocked)
+					m_Lock.wait();
+				return !closed;
+			}
+			finally
+			{
+				putInt(waiting, 0);
+			}
+		}
+	}
+
+	private void wakeOther(final int waiting)
+	{
+		final int waiter = getInt(waiting);
+		if (waiter == JAVA_WAITER)
+			wake();
+		else if (waiter == NATIVE_WAITER)
+		{
+			synchronized (m_Lock)
+			{
+				if (m_Ptr != 0)
+					nativeWake(m_Ptr);
+			}
+		}
+	}
+
+	private boolean fits(final long head, final long tail, final int frame)
+	{
+		final int toEnd = m_Capacity - (int) (head & (m_Capacity - 1));
+		final int needed = frame <= toEnd ? frame : toEnd + frame;
+		return head - tail + needed <= m_Capacity;
+	}
+
+	private static int frameSize(final int length) { return 4 + ((length + 3) & ~3); }
+
+	private long getLong(final int offset)
+	{
+		// may tear on 32 bit cpus; there is one writer, so two equal reads are a whole value
+		long value = m_Storage.getLong(offset);
+		for (long again; (again = m_Storage.getLong(offset)) != value;)
+			value = again;
+		acquire();
+		return value;
+	}
+
+	private void putLong(final int offset, final long value)
+	{
+		s_Fence = 0; // release: earlier frame writes are visible first
+		m_Storage.putLong(offset, value);
+		s_Fence = 0; // and this store before later loads (waiter flags)
+	}
+
+	private int getInt(final int offset)
+	{
+		final int value = m_Storage.getInt(offset);
+		acquire();
+		return value;
+	}
+
+	private void putInt(final int offset, final int value)
+	{
+		s_Fence = 0;
+		m_Storage.putInt(offset, value);
+		s_Fence = 0;
+	}
+
+	// later reads can't move before the preceding load
+	private static int acquire() { return s_Fence; }
+}
@@ -0,0 +1,412 @@
+#include "StreamAdapter.h"
+#include "APIHelper.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+namespace jni
+{
+
+static jni::Class s_ChannelsClass("java/nio/channels/Channels");
+static jni::Class s_ReadableChannelClass("java/nio/channels/ReadableByteChannel");
+static jni::Class s_WritableChannelClass("java/nio/channels/WritableByteChannel");
+static jni::Class s_FlushableClass("java/io/Flushable");
+static jni::Class s_BufferClass("java/nio/Buffer");
+
+static jlong MonotonicNanos()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<jlong>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// --------------------------------------------------------------------------------------
+// StreamAdapter
+// --------------------------------------------------------------------------------------
+StreamAdapter::StreamAdapter(size_t chunkSize)
+: m_ChunkSize(chunkSize)
+, m_Channel(0)
+, m_Started(false)
+, m_Running(false)
+, m_Stopping(false)
+, m_Failed(false)
+{
+	memset(m_Chunks, 0, sizeof(m_Chunks));
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Changed, NULL);
+}
+
+StreamAdapter::~StreamAdapter()
+{
+	Stop();
+	for (size_t i = 0; i < 2; ++i)
+	{
+		if (m_Chunks[i].buffer)
+			jni::DeleteGlobalRef(m_Chunks[i].buffer);
+		free(m_Chunks[i].data);
+	}
+	if (m_Channel)
+		jni::DeleteGlobalRef(m_Channel);
+	pthread_cond_destroy(&m_Changed);
+	pthread_mutex_destroy(&m_Lock);
+}
+
+bool StreamAdapter::Start(jobject channel)
+{
+	jni::LocalFrame frame;
+	m_Channel = channel ? jni::NewGlobalRef(channel) : 0;
+	if (!m_Channel)
+	{
+		m_Failed = true;
+		return false;
+	}
+	for (size_t i = 0; i < 2; ++i)
+	{
+		Chunk& chunk = m_Chunks[i];
+		if (posix_memalign(&chunk.data, 64, m_ChunkSize) != 0)
+			chunk.data = 0;
+		chunk.buffer = chunk.data ? jni::NewGlobalRef(jni::NewDirectByteBuffer(chunk.data, m_ChunkSize)) : 0;
+		if (!chunk.buffer)
+		{
+			m_Failed = true;
+			return false;
+		}
+	}
+	m_Running = true;
+	m_Started = pthread_create(&m_Thread, NULL, StreamAdapter::ThreadMain, this) == 0;
+	if (!m_Started)
+	{
+		m_Running = false;
+		m_Failed = true;
+	}
+	return m_Started;
+}
+
+void StreamAdapter::Stop()
+{
+	pthread_mutex_lock(&m_Lock);
+	bool join = m_Started && !m_Stopping;
+	m_Stopping = true;
+	pthread_cond_broadcast(&m_Changed);
+	pthread_mutex_unlock(&m_Lock);
+	if (join)
+		pthread_join(m_Thread, NULL);
+}
+
+void* StreamAdapter::ThreadMain(void* arg)
+{
+	StreamAdapter* adapter = static_cast<StreamAdapter*>(arg);
+	{
+		jni::ThreadScope scope;
+		jni::AttachCurrentThread();
+		adapter->Run();
+	}
+	pthread_mutex_lock(&adapter->m_Lock);
+	adapter->m_Running = false;
+	pthread_cond_broadcast(&adapter->m_Changed);
+	pthread_mutex_unlock(&adapter->m_Lock);
+	return 0;
+}
+
+bool StreamAdapter::Wait(size_t index, int state)
+{
+	while (m_Chunks[index].state != state)
+	{
+		if (m_Stopping || !m_Running)
+			return false;
+		pthread_cond_wait(&m_Changed, &m_Lock);
+	}
+	return true;
+}
+
+// Backs off (yield, then sleeps up to 10ms); false once stopping
+bool StreamAdapter::Idle(unsigned count)
+{
+	pthread_mutex_lock(&m_Lock);
+	bool stopping = m_Stopping;
+	pthread_mutex_unlock(&m_Lock);
+	if (stopping)
+		return false;
+	if (count < 16)
+		sched_yield();
+	else
+	{
+		timespec delay = { 0, (count < 26 ? (count - 15) : 10) * 1000000L };
+		nanosleep(&delay, NULL);
+	}
+	return true;
+}
+
+void StreamAdapter::Signal(size_t index, int state)
+{
+	pthread_mutex_lock(&m_Lock);
+	m_Chunks[index].state = state;
+	pthread_cond_broadcast(&m_Changed);
+	pthread_mutex_unlock(&m_Lock);
+}
+
+StreamAdapter::Stats StreamAdapter::GetStats()
+{
+	pthread_mutex_lock(&m_Lock);
+	Stats stats = m_Stats;
+	pthread_mutex_unlock(&m_Lock);
+	return stats;
+}
+
+double StreamAdapter::GetThroughput()
+{
+	Stats stats = GetStats();
+	return stats.ioNanos ? stats.bytes * 1e9 / stats.ioNanos : 0.0;
+}
+
+// --------------------------------------------------------------------------------------
+// StreamReader
+// --------------------------------------------------------------------------------------
+StreamReader::StreamReader(jobject source, size_t chunkSize)
+: StreamAdapter(chunkSize)
+, m_Current(0)
+, m_Finished(false)
+{
+	jni::LocalFrame frame;
+	jobject channel = source;
+	if (source && !jni::IsInstanceOf(source, s_ReadableChannelClass))
+	{
+		static jmethodID newChannelID = jni::GetStaticMethodID(s_ChannelsClass, "newChannel", "(Ljava/io/InputStream;)Ljava/nio/channels/ReadableByteChannel;");
+		channel = jni::Op<jobject>::CallStaticMethod(s_ChannelsClass, newChannelID, source);
+	}
+	Start(channel);
+}
+
+StreamReader::~StreamReader()
+{
+	Stop();
+}
+
+void StreamReader::Run()
+{
+	static jmethodID readID = jni::GetMethodID(s_ReadableChannelClass, "read", "(Ljava/nio/ByteBuffer;)I");
+	static jmethodID clearID = jni::GetMethodID(s_BufferClass, "clear", "()Ljava/nio/Buffer;");
+
+	bool finished = false;
+	for (size_t index = 0; !finished; index ^= 1)
+	{
+		pthread_mutex_lock(&m_Lock);
+		bool free = Wait(index, kChunkFree);
+		pthread_mutex_unlock(&m_Lock);
+		if (!free)
+			return;
+
+		Chunk& chunk = m_Chunks[index];
+		jni::LocalFrame frame;
+		jni::DeleteLocalRef(jni::Op<jobject>::CallMethod(chunk.buffer, clearID));
+		chunk.size = 0;
+		chunk.offset = 0;
+		jlong calls = 0;
+		jlong start = MonotonicNanos();
+		// hand over as soon as anything arrived; slow or interactive streams mustn't wait for a full chunk
+		for (unsigned idle = 0; chunk.size == 0 && !finished; ++idle)
+		{
+			jint read = jni::Op<jint>::CallMethod(m_Channel, readID, chunk.buffer);
+			++calls;
+			if (jni::CheckError())
+			{
+				m_Failed = true;
+				finished = true;
+			}
+			else if (read < 0)
+				finished = true;
+			else if (read > 0)
+				chunk.size = read;
+			else if (!Idle(idle)) // non-blocking channel without data
+				return;
+		}
+		jlong elapsed = MonotonicNanos() - start;
+
+		pthread_mutex_lock(&m_Lock);
+		m_Stats.bytes += chunk.size;
+		m_Stats.calls += calls;
+		m_Stats.ioNanos += elapsed;
+		pthread_mutex_unlock(&m_Lock);
+		Signal(index, kChunkReady);
+	}
+}
+
+ssize_t StreamReader::Read(void* data, size_t size)
+{
+	size_t copied = 0;
+	pthread_mutex_lock(&m_Lock);
+	while (copied < size && !m_Finished)
+	{
+		Chunk& chunk = m_Chunks[m_Current];
+		if (chunk.state != kChunkReady)
+		{
+			if (copied) // don't hold back what we have
+				break;
+			jlong start = MonotonicNanos();
+			bool ready = Wait(m_Current, kChunkReady);
+			m_Stats.stallNanos += MonotonicNanos() - start;
+			if (!ready)
+			{
+				m_Finished = true;
+				break;
+			}
+		}
+
+		size_t count = chunk.size - chunk.offset;
+		if (count > size - copied)
+			count = size - copied;
+		pthread_mutex_unlock(&m_Lock);
+		memcpy(static_cast<char*>(data) + copied, static_cast<char*>(chunk.data) + chunk.offset, count);
+		pthread_mutex_lock(&m_Lock);
+		chunk.offset += count;
+		copied += count;
+		if (chunk.offset == chunk.size)
+		{
+			chunk.state = kChunkFree;
+			pthread_cond_broadcast(&m_Changed);
+			m_Current ^= 1;
+		}
+	}
+	pthread_mutex_unlock(&m_Lock);
+	if (!copied && m_Failed)
+		return -1;
+	return copied;
+}
+
+// --------------------------------------------------------------------------------------
+// StreamWriter
+// --------------------------------------------------------------------------------------
+StreamWriter::StreamWriter(jobject sink, size_t chunkSize)
+: StreamAdapter(chunkSize)
+, m_Sink(sink ? jni::NewGlobalRef(sink) : 0)
+, m_Current(0)
+{
+	jni::LocalFrame frame;
+	jobject channel = sink;
+	if (sink && !jni::IsInstanceOf(sink, s_WritableChannelClass))
+	{
+		static jmethodID newChannelID = jni::GetStaticMethodID(s_ChannelsClass, "newChannel", "(Ljava/io/OutputStream;)Ljava/nio/channels/WritableByteChannel;");
+		channel = jni::Op<jobject>::CallStaticMethod(s_ChannelsClass, newChannelID, sink);
+	}
+	Start(channel);
+}
+
+StreamWriter::~StreamWriter()
+{
+	Flush();
+	Stop();
+	if (m_Sink)
+		jni::DeleteGlobalRef(m_Sink);
+}
+
+void StreamWriter::Run()
+{
+	static jmethodID writeID = jni::GetMethodID(s_WritableChannelClass, "write", "(Ljava/nio/ByteBuffer;)I");
+	static jmethodID clearID = jni::GetMethodID(s_BufferClass, "clear", "()Ljava/nio/Buffer;");
+	static jmethodID limitID = jni::GetMethodID(s_BufferClass, "limit", "(I)Ljava/nio/Buffer;");
+
+	for (size_t index = 0; ; index ^= 1)
+	{
+		pthread_mutex_lock(&m_Lock);
+		bool ready = Wait(index, kChunkReady);
+		pthread_mutex_unlock(&m_Lock);
+		if (!ready)
+			return;
+
+		Chunk& chunk = m_Chunks[index];
+		jni::LocalFrame frame;
+		jni::DeleteLocalRef(jni::Op<jobject>::CallMethod(chunk.buffer, clearID));
+		jni::DeleteLocalRef(jni::Op<jobject>::CallMethod(chunk.buffer, limitID, static_cast<jint>(chunk.size)));
+		size_t written = 0;
+		jlong calls = 0;
+		jlong start = MonotonicNanos();
+		for (unsigned idle = 0; written < chunk.size && !m_Failed;)
+		{
+			jint count = jni::Op<jint>::CallMethod(m_Channel, writeID, chunk.buffer);
+			++calls;
+			if (jni::CheckError())
+				m_Failed = true;
+			else if (count > 0)
+			{
+				written += count;
+				idle = 0;
+			}
+			else if (!Idle(idle++)) // non-blocking channel that's full
+				return;
+		}
+		jlong elapsed = MonotonicNanos() - start;
+
+		pthread_mutex_lock(&m_Lock);
+		m_Stats.bytes += written;
+		m_Stats.calls += calls;
+		m_Stats.ioNanos += elapsed;
+		pthread_mutex_unlock(&m_Lock);
+		chunk.size = 0;
+		Signal(index, kChunkFree);
+	}
+}
+
+bool StreamWriter::Write(const void* data, size_t size)
+{
+	size_t copied = 0;
+	pthread_mutex_lock(&m_Lock);
+	while (copied < size && !m_Failed)
+	{
+		Chunk& chunk = m_Chunks[m_Current];
+		if (chunk.state != kChunkFree)
+		{
+			jlong start = MonotonicNanos();
+			bool free = Wait(m_Current, kChunkFree);
+			m_Stats.stallNanos += MonotonicNanos() - start;
+			if (!free)
+				break;
+		}
+
+		size_t count = m_ChunkSize - chunk.size;
+		if (count > size - copied)
+			count = size - copied;
+		pthread_mutex_unlock(&m_Lock);
+		memcpy(static_cast<char*>(chunk.data) + chunk.size, static_cast<const char*>(data) + copied, count);
+		pthread_mutex_lock(&m_Lock);
+		chunk.size += count;
+		copied += count;
+		if (chunk.size == m_ChunkSize)
+		{
+			chunk.state = kChunkReady;
+			pthread_cond_broadcast(&m_Changed);
+			m_Current ^= 1;
+		}
+	}
+	pthread_mutex_unlock(&m_Lock);
+	return copied == size;
+}
+
+bool StreamWriter::Flush()
+{
+	pthread_mutex_lock(&m_Lock);
+	Chunk& current = m_Chunks[m_Current];
+	if (current.state == kChunkFree && current.size)
+	{
+		current.state = kChunkReady;
+		pthread_cond_broadcast(&m_Changed);
+		m_Current ^= 1;
+	}
+	jlong start = MonotonicNanos();
+	bool written = Wait(0, kChunkFree) && Wait(1, kChunkFree);
+	m_Stats.stallNanos += MonotonicNanos() - start;
+	pthread_mutex_unlock(&m_Lock);
+	if (!written || m_Failed)
+		return false;
+
+	if (m_Sink && jni::IsInstanceOf(m_Sink, s_FlushableClass))
+	{
+		static jmethodID flushID = jni::GetMethodID(s_FlushableClass, "flush", "()V");
+		jni::Op<jvoid>::CallMethod(m_Sink, flushID);
+	}
+	return !jni::CheckError();
+}
+
+}
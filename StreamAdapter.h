@@ -0,0 +1,111 @@
+#pragma once
+
+#include "JNIBridge.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace jni
+{
+
+// Moves java stream data through two large direct buffers. A background
+// (attached) thread does the java i/o on one buffer while native code
+// works on the other.
+class StreamAdapter
+{
+public:
+	struct Stats
+	{
+		jlong bytes;      // bytes moved through java
+		jlong calls;      // java read/write calls
+		jlong ioNanos;    // time the background thread spent in java
+		jlong stallNanos; // time native code waited for the background thread
+	};
+
+	Stats  GetStats();
+	// Bytes per second of java i/o time
+	double GetThroughput();
+	inline bool Failed() const { return m_Failed; }
+
+protected:
+	enum { kChunkFree, kChunkReady };
+
+	struct Chunk
+	{
+		void*   data;
+		jobject buffer; // direct ByteBuffer over data, global ref
+		size_t  size;
+		size_t  offset;
+		int     state;
+	};
+
+	StreamAdapter(size_t chunkSize);
+	virtual ~StreamAdapter();
+
+	bool Start(jobject channel);
+	void Stop();
+
+	// waits until chunk 'index' is in 'state' or the thread quit; call with m_Lock held
+	bool Wait(size_t index, int state);
+	void Signal(size_t index, int state);
+	bool Idle(unsigned count);
+
+	virtual void Run() = 0;
+
+	size_t          m_ChunkSize;
+	Chunk           m_Chunks[2];
+	jobject         m_Channel; // global ref
+	pthread_t       m_Thread;
+	pthread_mutex_t m_Lock;
+	pthread_cond_t  m_Changed;
+	bool            m_Started;
+	volatile bool   m_Running;
+	volatile bool   m_Stopping;
+	volatile bool   m_Failed;
+	Stats           m_Stats;
+
+private:
+	StreamAdapter(const StreamAdapter& adapter);
+	StreamAdapter& operator = (const StreamAdapter& o);
+
+	static void* ThreadMain(void* arg);
+};
+
+// Reads a java.io.InputStream or java.nio.channels.ReadableByteChannel ahead of the caller.
+// A chunk is handed over as soon as a read returned data (at most a chunk), or at the end of the stream.
+class StreamReader : public StreamAdapter
+{
+public:
+	StreamReader(jobject source, size_t chunkSize = 256 * 1024);
+	virtual ~StreamReader();
+
+	// Returns the number of bytes read, 0 at the end of the stream or -1 if java failed
+	ssize_t Read(void* data, size_t size);
+
+private:
+	virtual void Run();
+
+	size_t m_Current;
+	bool   m_Finished;
+};
+
+// Writes to a java.io.OutputStream or java.nio.channels.WritableByteChannel behind the caller.
+// The stream is flushed, but not closed, on destruction.
+class StreamWriter : public StreamAdapter
+{
+public:
+	StreamWriter(jobject sink, size_t chunkSize = 256 * 1024);
+	virtual ~StreamWriter();
+
+	bool Write(const void* data, size_t size);
+	// Waits until java has written everything; flushes the stream if it is java.io.Flushable
+	bool Flush();
+
+private:
+	virtual void Run();
+
+	jobject m_Sink; // global ref
+	size_t  m_Current;
+};
+
+}
@@ -0,0 +1,4 @@
+jni::ObjectIterator<> Iterable::begin() const { return jni::ObjectIterator<>(m_Object); }
+jni::ObjectIterator<> Iterable::end() const { return jni::ObjectIterator<>(); }
+
+void Iterable::__Initialize() { }
@@ -0,0 +1,4 @@
+jni::ObjectIterator<> Enumeration::begin() const { return jni::ObjectIterator<>(m_Object); }
+jni::ObjectIterator<> Enumeration::end() const { return jni::ObjectIterator<>(); }
+
+void Enumeration::__Initialize() { }
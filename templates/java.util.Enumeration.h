@@ -0,0 +1,2 @@
+jni::ObjectIterator<> begin() const;
+jni::ObjectIterator<> end() const;
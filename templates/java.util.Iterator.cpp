@@ -0,0 +1,4 @@
+jni::ObjectIterator<> Iterator::begin() const { return jni::ObjectIterator<>(m_Object); }
+jni::ObjectIterator<> Iterator::end() const { return jni::ObjectIterator<>(); }
+
+void Iterator::__Initialize() { }
@@ -1,9 +1,19 @@
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 
 #include "API.h"
 #include "Proxy.h"
+#include "PeerRegistry.h"
+#include "BufferArena.h"
+#include "MappedBuffer.h"
+#include "StreamAdapter.h"
+#include "RingBuffer.h"
+#include "DirectBuffer.h"
+#include "CommandBuffer.h"
+#include "MapCall.h"
+#include "Collections.h"
 
 using namespace java::lang;
 using namespace java::io;
@@ -124,6 +134,12 @@ int main(int,char**)
 	{
 		int* p = 0; *p = 3;
 	}
+	// upcasts are resolved at compile time
+	java::lang::Integer integer(42);
+	if (!jni::InstanceOf<java::lang::Number>(integer) || !jni::Cast<java::lang::Object>(integer))
+	{
+		int* p = 0; *p = 3;
+	}
 
 	// -------------------------------------------------------------
 	// Array Test
@@ -217,6 +233,41 @@ int main(int,char**)
 	gettimeofday(&stop, NULL);
 	printf("count: %d, time: %f ms.\n", 1024, (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_usec - start.tv_usec) / 1000.0);
 
+	// -------------------------------------------------------------
+	// Async Proxy Test
+	// -------------------------------------------------------------
+	struct AsyncRunnable : jni::Proxy<Runnable>
+	{
+		volatile int i;
+		AsyncRunnable() : jni::Proxy<Runnable>(jni::kProxyDispatchAsyncOrdered), i(0) {}
+		virtual ~AsyncRunnable() { printf("async count: %d\n", i); }
+		virtual void Run() { ++i; }
+	};
+	jni::ProxyDispatcher::Start(2);
+	AsyncRunnable* asyncRunner = new AsyncRunnable;
+	Runnable asyncRunnable = *asyncRunner;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < 1024; ++i)
+		asyncRunnable.Run();
+	gettimeofday(&stop, NULL);
+	printf("async post time: %f ms.\n", (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_usec - start.tv_usec) / 1000.0);
+	asyncRunner->Destroy(); // deleted once the queued callbacks ran
+
+	// a callback may release its own proxy
+	struct OneShotRunnable : jni::Proxy<Runnable>
+	{
+		OneShotRunnable() : jni::Proxy<Runnable>(jni::kProxyDispatchAsync) {}
+		virtual ~OneShotRunnable() { printf("one shot deleted\n"); }
+		virtual void Run() { Destroy(); }
+	};
+	Runnable oneShot = *new OneShotRunnable;
+	oneShot.Run();
+
+	jni::ProxyDispatcher::Stats dispatchStats;
+	jni::ProxyDispatcher::GetStats(&dispatchStats);
+	printf("posted: %u, executed: %u, max depth: %u\n", dispatchStats.posted, dispatchStats.executed, dispatchStats.maxDepth);
+	jni::ProxyDispatcher::Stop();
+
 	// -------------------------------------------------------------
 	// Weak Proxy Test
 	// -------------------------------------------------------------
@@ -237,6 +288,28 @@ int main(int,char**)
 		System::Gc();
 	}
 
+	// -------------------------------------------------------------
+	// Native Footprint Test
+	// -------------------------------------------------------------
+	struct HeavyRunnable : jni::WeakProxy<Runnable>
+	{
+		HeavyRunnable() : m_Buffer(malloc(4*1024*1024)) { SetNativeFootprint(4*1024*1024); }
+		virtual ~HeavyRunnable() { free(m_Buffer); }
+		virtual void Run() { }
+		void* m_Buffer;
+	};
+
+	jni::ProxyObject::SetFootprintThreshold(16*1024*1024);
+	for (int i = 0; i < 32; ++i)
+	{
+		jni::LocalFrame frame;
+		new HeavyRunnable;
+	}
+	jni::ProxyObject::FootprintStats footprintStats;
+	jni::ProxyObject::GetFootprintStats(&footprintStats);
+	printf("footprint: %zu, high water: %zu, reclaims: %u\n", footprintStats.bytes, footprintStats.highWater, footprintStats.reclaims);
+	jni::ProxyObject::SetFootprintThreshold(0);
+
 	// -------------------------------------------------------------
 	// Multiple Proxy Interface Test
 	// -------------------------------------------------------------
@@ -306,6 +379,264 @@ int main(int,char**)
 		printf("%s", "end of multi interface test\n");
 	}
 
+	// -------------------------------------------------------------
+	// Peer Registry Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		struct PeerRunnable : jni::Proxy<Runnable>
+		{
+			virtual void Run() { }
+		};
+
+		PeerRunnable peerRunnable;
+		Runnable runnable = peerRunnable;
+		jni::PeerRegistry::Register(runnable, &peerRunnable);
+
+		Object roundTrip = runnable; // pretend this came back from java
+		printf("peer found: %d\n", jni::PeerRegistry::Lookup<PeerRunnable>(roundTrip) == &peerRunnable);
+		jni::PeerRegistry::Unregister(runnable);
+		printf("peer removed: %d, entries: %zu\n", jni::PeerRegistry::Lookup(roundTrip) == 0, jni::PeerRegistry::Size());
+
+		// collected objects are pruned, and the table keeps working afterwards
+		for (int i = 0; i < 64; ++i)
+		{
+			jni::LocalFrame dropped;
+			jni::PeerRegistry::Register(java::lang::Integer(100000 + i), &peerRunnable);
+		}
+		System::Gc();
+		jni::PeerRegistry::Purge();
+		jni::PeerRegistry::Register(runnable, &peerRunnable);
+		bool found = jni::PeerRegistry::Lookup(roundTrip) == &peerRunnable;
+		printf("peers after purge: %zu, found: %d, error: %d\n", jni::PeerRegistry::Size(), found, jni::CheckError());
+		jni::PeerRegistry::Unregister(runnable);
+	}
+
+	// -------------------------------------------------------------
+	// Buffer Arena Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		if (!jni::BufferArena::__Register())
+			printf("%s\n", jni::GetErrorMessage());
+
+		jni::BufferArena arena(4096);
+		jni::ArenaBuffer* buffer = arena.Acquire();
+		memset(buffer->Data(), 7, buffer->Size());
+		printf("arena capacity: %lld\n", (long long)jni::GetDirectBufferCapacity(buffer->ByteBuffer()));
+		arena.Release(buffer);
+		jni::ArenaBuffer* recycled = arena.Acquire();
+		printf("arena recycled: %d\n", recycled == buffer);
+		arena.HandOff(recycled);
+		System::Gc();
+		System::RunFinalization();
+		jni::BufferArena::Stats stats = arena.GetStats();
+		printf("arena acquires: %zu, reuses: %zu, hand offs: %zu\n", stats.acquires, stats.reuses, stats.handOffs);
+	}
+
+	// -------------------------------------------------------------
+	// Mapped Buffer Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		if (!jni::MappedBuffer::__Register())
+			printf("%s\n", jni::GetErrorMessage());
+
+		jobject mapped = jni::MappedBuffer::Map(__FILE__, 2, 16);
+		printf("mapped: %.16s\n", static_cast<const char*>(jni::GetDirectBufferAddress(mapped)));
+	}
+
+	// -------------------------------------------------------------
+	// Stream Adapter Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		ByteArrayOutputStream bytes;
+		{
+			jni::StreamWriter writer(bytes, 16);
+			for (int i = 0; i < 10; ++i)
+				writer.Write("0123456789", 10);
+		}
+		ByteArrayInputStream input(bytes.ToByteArray());
+		jni::StreamReader reader(input, 16);
+		char data[128];
+		ssize_t total = 0, count;
+		while ((count = reader.Read(data + total, sizeof(data) - total)) > 0)
+			total += count;
+		jni::StreamAdapter::Stats stats = reader.GetStats();
+		printf("streamed %zd bytes in %lld calls: %.10s\n", total, (long long)stats.calls, data + 90);
+	}
+
+	// -------------------------------------------------------------
+	// Ring Buffer Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		if (!jni::RingBuffer::__Register())
+			printf("%s\n", jni::GetErrorMessage());
+
+		jni::RingBuffer ring(256);
+		int written = 0;
+		for (int i = 0; i < 100; ++i)
+			written += ring.TryWrite(&i, sizeof(i)) ? 1 : 0;
+		int value = -1, read = 0;
+		while (ring.TryRead(&value, sizeof(value)) == sizeof(value))
+			++read;
+		printf("ring frames written: %d, read: %d, last: %d\n", written, read, value);
+	}
+
+	// -------------------------------------------------------------
+	// Direct Buffer Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		jbyte bytes[16];
+		for (int i = 0; i < 16; ++i)
+			bytes[i] = i;
+		jobject buffer = jni::NewDirectByteBuffer(bytes, sizeof(bytes));
+		jni::DirectBuffer<jbyte> byteView(buffer);
+		int sum = 0;
+		for (jbyte value : byteView)
+			sum += value;
+		// new direct buffers are big endian; wider views are copied unless that is native
+		jni::DirectBuffer<jint> intView(buffer);
+		printf("byte view: %zu elements, sum %d, in place %d\n", byteView.Size(), sum, !byteView.IsCopy());
+		printf("int view: %zu elements, first %08x, out of range %d\n", intView.Size(), intView[0], intView.At(4) == 0);
+		jni::CheckError();
+	}
+
+	// -------------------------------------------------------------
+	// Command Buffer Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		Properties properties;
+		static jmethodID setPropertyID = jni::GetMethodID(Properties::__CLASS, "setProperty", "(Ljava/lang/String;Ljava/lang/String;)Ljava/lang/Object;");
+		jni::CommandBuffer commands;
+		char key[16];
+		for (int i = 0; i < 40; ++i)
+		{
+			snprintf(key, sizeof(key), "key%d", i);
+			commands.Call(properties, setPropertyID, key, "value");
+		}
+		size_t recorded = commands.Size();
+		bool submitted = commands.Submit();
+		printf("commands recorded: %zu, submitted: %d, properties: %d\n", recorded, submitted, properties.Size());
+	}
+
+	// -------------------------------------------------------------
+	// Map Call Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		jni::Array<java::lang::Integer> integers(4, (java::lang::Integer[]){1, 2, 3, 4});
+		static jmethodID intValueID = jni::GetMethodID(java::lang::Integer::__CLASS, "intValue", "()I");
+		static jfieldID valueID = jni::GetFieldID(java::lang::Integer::__CLASS, "value", "I");
+		jni::MapCall<jint> values(integers, intValueID);
+		jni::MapField<jfloat> widened(integers, valueID);
+		int sum = 0;
+		for (jint value : values)
+			sum += value;
+		printf("mapped %zu values, sum %d, widened %.1f\n", values.Size(), sum, widened[3]);
+	}
+
+	// -------------------------------------------------------------
+	// Struct Mirror Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		// declared in a different order than java's, after padding
+		struct PointMirror { jlong pad; jint y; jint x; };
+		static jni::Class pointClass("java/awt/Point");
+		static const jni::MirrorField pointFields[] = { { "x", 'I', offsetof(PointMirror, x) }, { "y", 'I', offsetof(PointMirror, y) } };
+		static jni::MirrorLayout pointLayout(pointClass, pointFields, 2, sizeof(PointMirror));
+		static jmethodID pointConstructorID = jni::GetMethodID(pointClass, "<init>", "(II)V");
+		static jfieldID xID = jni::GetFieldID(pointClass, "x", "I");
+		static jfieldID yID = jni::GetFieldID(pointClass, "y", "I");
+		jobjectArray points = jni::NewObjectArray(3, pointClass);
+		jni::SetObjectArrayElement(points, 0, jni::NewObject(pointClass, pointConstructorID, 0x01020304, -7));
+		jni::SetObjectArrayElement(points, 2, jni::NewObject(pointClass, pointConstructorID, 5, 6));
+		PointMirror mirrors[3];
+		memset(mirrors, 0xff, sizeof(mirrors));
+		bool snapshot = pointLayout.Snapshot(points, mirrors);
+		printf("point mirrors: %d, %08x %d, pad %d, null skipped %d, last %d %d\n", snapshot,
+			mirrors[0].x, mirrors[0].y, mirrors[0].pad == -1, mirrors[1].x == -1, mirrors[2].x, mirrors[2].y);
+		mirrors[0].x += 1;
+		mirrors[2].y = 60;
+		bool writeBack = pointLayout.WriteBack(points, mirrors);
+		jobject first = jni::GetObjectArrayElement(points, 0);
+		jobject last = jni::GetObjectArrayElement(points, 2);
+		printf("point write back: %d, %08x %d, last %d %d\n", writeBack,
+			jni::Op<jint>::GetField(first, xID), jni::Op<jint>::GetField(first, yID), jni::Op<jint>::GetField(last, xID), jni::Op<jint>::GetField(last, yID));
+
+		// 'Z' writes one byte and 'C' two; final fields (both 'value's) aren't written back
+		struct ValueMirror { jboolean flag; jbyte guard; jchar letter; };
+		static jni::Class booleanClass("java/lang/Boolean");
+		static jni::Class characterClass("java/lang/Character");
+		static const jni::MirrorField flagFields[] = { { "value", 'Z', offsetof(ValueMirror, flag) } };
+		static const jni::MirrorField letterFields[] = { { "value", 'C', offsetof(ValueMirror, letter) } };
+		static jni::MirrorLayout flagLayout(booleanClass, flagFields, 1, sizeof(ValueMirror));
+		static jni::MirrorLayout letterLayout(characterClass, letterFields, 1, sizeof(ValueMirror));
+		static jmethodID booleanConstructorID = jni::GetMethodID(booleanClass, "<init>", "(Z)V");
+		static jmethodID characterConstructorID = jni::GetMethodID(characterClass, "<init>", "(C)V");
+		static jmethodID charValueID = jni::GetMethodID(characterClass, "charValue", "()C");
+		jobject letter = jni::NewObject(characterClass, characterConstructorID, static_cast<jchar>(0x20ac));
+		ValueMirror value;
+		memset(&value, 0x7f, sizeof(value));
+		flagLayout.Snapshot(jni::NewObject(booleanClass, booleanConstructorID, static_cast<jboolean>(JNI_TRUE)), &value);
+		letterLayout.Snapshot(letter, &value);
+		printf("value mirror: flag %d, guard %d, letter %04x\n", value.flag, value.guard == 0x7f, value.letter);
+		value.letter = 'A';
+		letterLayout.WriteBack(letter, &value);
+		printf("final skipped: %04x, error: %d\n", jni::Op<jchar>::CallMethod(letter, charValueID), jni::CheckError());
+	}
+
+	// -------------------------------------------------------------
+	// Collections Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		std::unordered_map<std::string, std::string> properties;
+		jni::ToStringMap(System::GetProperties(), properties);
+		printf("properties: %zu, java.version: %s\n", properties.size(), properties["java.version"].c_str());
+
+		std::vector<jint> numbers;
+		for (int i = 0; i < 10; ++i)
+			numbers.push_back(i * i);
+		std::vector<jdouble> widened;
+		jni::ToVector(jni::NewList(numbers), widened);
+		std::vector<std::string> strings;
+		strings.push_back("h\xc3\xa9llo");
+		strings.push_back("world");
+		std::vector<std::string> roundTrip;
+		jni::ToStrings(jni::NewList(strings), roundTrip);
+		printf("numbers: %zu, last %.1f, strings: %s %s\n", widened.size(), widened.back(), roundTrip[0].c_str(), roundTrip[1].c_str());
+	}
+
+	// -------------------------------------------------------------
+	// Iteration Test
+	// -------------------------------------------------------------
+	{
+		jni::LocalFrame frame;
+		int count = 0;
+		for (jobject key : System::GetProperties().Keys())
+			count += key != 0;
+		std::vector<std::string> strings;
+		strings.push_back("one");
+		strings.push_back("two");
+		strings.push_back("three");
+		std::string joined;
+		for (String string : jni::Iterate<String>(jni::NewList(strings), 2))
+			joined += string.c_str();
+		printf("iterated %d keys, %s\n", count, joined.c_str());
+
+		// the first element of every batch must still be alive in the loop body
+		std::string firsts;
+		for (jobject element : jni::Iterate<jobject>(jni::NewList(strings), 2))
+			firsts += String(element).c_str();
+		printf("dereferenced %s\n", firsts.c_str());
+	}
+
 	// -------------------------------------------------------------
 	// Proxy Object Test
 	// -------------------------------------------------------------